@@ -9,7 +9,7 @@
 #include "util.h"
 
 namespace {
-    const std::unordered_set<Interval> from_system = {
+    constexpr IntervalSet from_system = {
         Interval::Sometimes,
         Interval::Rarely,
         Interval::Random,
@@ -17,7 +17,7 @@ namespace {
         Interval::Always,
         Interval::Runonce,
     };
-    const std::unordered_set<Interval> from_user = {
+    constexpr IntervalSet from_user = {
         Interval::Sometimes,
         Interval::Rarely,
         Interval::Random,
@@ -28,10 +28,10 @@ namespace {
         Interval::YenE,
         Interval::Talk,
     };
-    const std::unordered_set<Interval> from_yen_e = {
+    constexpr IntervalSet from_yen_e = {
         Interval::YenE,
     };
-    const std::unordered_set<Interval> from_talk = {
+    constexpr IntervalSet from_talk = {
         Interval::Talk,
     };
 
@@ -55,10 +55,11 @@ namespace {
     }
 }
 
-Actor::Actor(const int id, const Animation &anim, Seriko *parent)
-    : id_(id), anim_(anim), parent_(parent) {
+Actor::Actor(const AnimationEntry &anim, std::span<const Pattern> patterns, Seriko *parent)
+    : id_(anim.id), anim_(anim), patterns_(patterns), pattern_({Method::Overlay, -1, 0, 0, 0, 0, {}}),
+    changed_(false), parent_(parent) {
     int total = 0;
-    for (auto &p : anim_.pattern) {
+    for (auto &p : patterns_) {
         total += p.wait_max;
     }
     loop0_ = (anim_.interval.contains(Interval::Always) && total == 0);
@@ -66,7 +67,7 @@ Actor::Actor(const int id, const Animation &anim, Seriko *parent)
 }
 
 void Actor::activate(From from) {
-    if (anim_.pattern.size() == 0) {
+    if (patterns_.size() == 0) {
         Logger::log("0-sized pattern");
         return;
     }
@@ -76,21 +77,11 @@ void Actor::activate(From from) {
     bool start = false;
     switch (from) {
         case From::System:
-            for (auto e : anim_.interval) {
-                start = from_system.contains(e);
-                if (start) {
-                    break;
-                }
-            }
+            start = anim_.interval.intersects(from_system);
             break;
         case From::Seriko:
         case From::User:
-            for (auto e : anim_.interval) {
-                start = from_user.contains(e);
-                if (start) {
-                    break;
-                }
-            }
+            start = anim_.interval.intersects(from_user);
             break;
         case From::YenE:
             start = anim_.interval.contains(Interval::YenE);
@@ -105,7 +96,7 @@ void Actor::activate(From from) {
     inactivate();
     active_ = true;
     index_ = 0;
-    auto &p = anim_.pattern[index_];
+    auto &p = patterns_[index_];
     wait_ = wait(p.wait_min, p.wait_max);
 }
 
@@ -113,6 +104,26 @@ const Pattern &Actor::currentPattern() const {
     return pattern_;
 }
 
+// 描画に使う値が変わった時だけ変化したことにする
+void Actor::setPattern(const Pattern &p) {
+    if (p.method != pattern_.method || p.id != pattern_.id || p.x != pattern_.x || p.y != pattern_.y) {
+        changed_ = true;
+    }
+    pattern_ = p;
+}
+
+// 次にupdateで状態が進むまでの時間(ms)
+std::optional<int> Actor::remain() const {
+    if (!active_) {
+        return std::nullopt;
+    }
+    // 待ち時間の無いalwaysはupdate毎に1msずつしか進まない
+    if (loop0_) {
+        return std::max(wait_, 1);
+    }
+    return wait_;
+}
+
 void Actor::update(int elapsed) {
     if (!active_) {
         return;
@@ -123,11 +134,11 @@ void Actor::update(int elapsed) {
     }
     else {
         elapsed -= wait_;
-        if (synthesis.contains(anim_.pattern[index_].method)) {
-            pattern_ = anim_.pattern[index_];
+        if (synthesis.contains(patterns_[index_].method)) {
+            setPattern(patterns_[index_]);
         }
         else {
-            auto &p = anim_.pattern[index_];
+            auto &p = patterns_[index_];
             switch (p.method) {
                 case Method::Move:
                     // TODO stub
@@ -164,14 +175,14 @@ void Actor::update(int elapsed) {
             }
         }
         index_++;
-        if (index_ == anim_.pattern.size()) {
+        if (index_ == patterns_.size()) {
             double x;
             do {
                 x = util::random();
             } while (x == 0);
             if (anim_.interval.contains(Interval::Always)) {
                 index_ = 0;
-                auto &p = anim_.pattern[index_];
+                auto &p = patterns_[index_];
                 wait_ = wait(p.wait_min, p.wait_max);
             }
             else if (anim_.interval.contains(Interval::Sometimes)) {
@@ -199,7 +210,7 @@ void Actor::update(int elapsed) {
             }
         }
         else {
-            auto &p = anim_.pattern[index_];
+            auto &p = patterns_[index_];
             wait_ = wait(p.wait_min, p.wait_max);
         }
         if (loop0_) {
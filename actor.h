@@ -1,23 +1,31 @@
 #ifndef ACTOR_H_
 #define ACTOR_H_
 
+#include <optional>
+#include <span>
+
 #include "seriko.h"
 #include "surface.h"
+#include "surface_table.h"
 
 class Seriko;
 
 class Actor {
     private:
         int id_;
-        Animation anim_;
+        // Serikoが持つ共有の定義を指す
+        const AnimationEntry &anim_;
+        std::span<const Pattern> patterns_;
         Pattern pattern_;
         int index_;
         int wait_;
         bool active_;
         bool loop0_;
+        // 前回takeChangedを呼んでから描画する内容が変わったか
+        bool changed_;
         Seriko *parent_;
     public:
-        Actor(const int id, const Animation &anim, Seriko *parent);
+        Actor(const AnimationEntry &anim, std::span<const Pattern> patterns, Seriko *parent);
         ~Actor() {}
         void activate(From from);
         bool active() const {
@@ -25,15 +33,25 @@ class Actor {
         }
         void inactivate() {
             active_ = false;
-            pattern_ = {Method::Overlay, -1, 0, 0, 0, 0, {}};
+            setPattern({Method::Overlay, -1, 0, 0, 0, 0, {}});
         }
         const Pattern &currentPattern() const;
+        void setPattern(const Pattern &p);
+        bool takeChanged() {
+            bool ret = changed_;
+            changed_ = false;
+            return ret;
+        }
+        std::optional<int> remain() const;
         void update(int elapsed);
-        const std::unordered_set<Interval> &interval() const {
+        int id() const {
+            return id_;
+        }
+        IntervalSet interval() const {
             return anim_.interval;
         }
-        const std::vector<Pattern> &patterns() const {
-            return anim_.pattern;
+        std::span<const Pattern> patterns() const {
+            return patterns_;
         }
 };
 
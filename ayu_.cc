@@ -1,6 +1,10 @@
 #include "ayu_.h"
 
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
 #include <cstdint>
+#include <cstring>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
@@ -38,17 +42,52 @@
 
 namespace {
     std::unordered_map<int, std::unique_ptr<Character>> characters;
+    // 1回の描画の後で先読みに使う時間(ms)
+    const int prefetch_budget = 4;
+    // ベースウェアに接続できない時に送り直す回数
+    const int send_retry = 8;
+
+    // 標準入力から長さ付きのフレームを読む
+    // バッファは使い回し、返すviewは次のreadまで有効
+    class FrameReader {
+        private:
+            std::vector<char> buffer_;
+            static bool readAll(char *p, size_t n) {
+                while (n > 0) {
+                    auto ret = ::read(0, p, n);
+                    if (ret < 0 && errno == EINTR) {
+                        continue;
+                    }
+                    if (ret <= 0) {
+                        return false;
+                    }
+                    p += ret;
+                    n -= ret;
+                }
+                return true;
+            }
+        public:
+            std::optional<std::string_view> read() {
+                uint32_t len;
+                if (!readAll(reinterpret_cast<char *>(&len), sizeof(uint32_t)) || len == 0) {
+                    return std::nullopt;
+                }
+                if (buffer_.size() < len) {
+                    buffer_.resize(len);
+                }
+                if (!readAll(buffer_.data(), len)) {
+                    return std::nullopt;
+                }
+                return std::string_view(buffer_.data(), len);
+            }
+    };
 
     void errorCallback(int code, const char *message) {
         Logger::log("Error(", code, "): ", message);
     }
-#if !defined(_WIN32) && !defined(WIN32)
-    inline int closesocket(int fd) {
-        return close(fd);
-    }
-#endif
 #if defined(USE_WAYLAND)
     wl_compositor *compositor = nullptr;
+    wl_subcompositor *subcompositor = nullptr;
     zxdg_output_manager_v1 *manager = nullptr;
 #endif // USE_WAYLAND
 }
@@ -67,6 +106,8 @@ Ayu::~Ayu() {
     th_send_->join();
     th_recv_->join();
     characters.clear();
+    // 読み込みのスレッドがglfwPostEmptyEventを呼ぶので先に止める
+    cache_.reset();
     glfwTerminate();
 #if defined(_WIN32) || defined(WIN32)
     WSACleanup();
@@ -105,6 +146,9 @@ bool Ayu::init() {
             if (s == "wl_compositor") {
                 compositor = static_cast<wl_compositor *>(wl_registry_bind(reg, id, &wl_compositor_interface, 1));
             }
+            if (s == "wl_subcompositor") {
+                subcompositor = static_cast<wl_subcompositor *>(wl_registry_bind(reg, id, &wl_subcompositor_interface, 1));
+            }
             if (s == "zxdg_output_manager_v1") {
                 manager = static_cast<zxdg_output_manager_v1 *>(wl_registry_bind(reg, id, &zxdg_output_manager_v1_interface, 1));
             }
@@ -124,31 +168,25 @@ bool Ayu::init() {
     assert(glfwGetError(nullptr) == GLFW_NO_ERROR);
 
     th_recv_ = std::make_unique<std::thread>([&]() {
+        FrameReader reader;
+        ayu::RequestView req;
+        std::string response;
         uint32_t len;
         while (true) {
-            std::cin.read(reinterpret_cast<char *>(&len), sizeof(uint32_t));
-            if (std::cin.eof() || len == 0) {
-                break;
-            }
-            char *buffer = new char[len];
-            std::cin.read(buffer, len);
-            std::string request(buffer, len);
-            delete[] buffer;
-            if (std::cin.gcount() < len) {
+            auto frame = reader.read();
+            if (!frame) {
                 break;
             }
-            auto req = ayu::Request::parse(request);
+            std::string_view request = frame.value();
+            req.parse(request);
             Logger::log(request);
-            auto event = req().value();
+            auto event = req().value_or("");
 
             ayu::Response res {204, "No Content"};
+            bool wakeup = false;
 
             if (event == "Initialize" && req(0)) {
-                std::string tmp;
-                {
-                    std::unique_lock<std::mutex> lock(mutex_);
-                    tmp = req(0).value();
-                }
+                auto tmp = req(0).value();
                 std::u8string dir(tmp.begin(), tmp.end());
                 ayu_dir_ = dir;
             }
@@ -165,13 +203,16 @@ bool Ayu::init() {
                     int n;
                     util::to_x(req(0).value(), n);
                     for (int i = 1; i <= n; i++) {
-                        auto &value = req(i).value();
-                        auto pos = value.find(',');
-                        if (pos == std::string::npos) {
+                        if (!req(i)) {
                             continue;
                         }
-                        auto key = value.substr(0, pos);
-                        value = value.substr(pos + 1);
+                        auto v = req(i).value();
+                        auto pos = v.find(',');
+                        if (pos == std::string_view::npos) {
+                            continue;
+                        }
+                        std::string key(v.substr(0, pos));
+                        std::string value(v.substr(pos + 1));
                         info_[key] = value;
                         do {
                             std::string tmp, group, name, category, part;
@@ -222,8 +263,7 @@ bool Ayu::init() {
             }
             else if (event == "Position" && req(0)) {
                 int side;
-                std::istringstream iss(req(0).value());
-                iss >> side;
+                util::to_x(req(0).value(), side);
                 res = {200, "OK"};
                 Rect r = getRect(side);
                 res(0) = r.x;
@@ -231,8 +271,7 @@ bool Ayu::init() {
             }
             else if (event == "Size" && req(0)) {
                 int side;
-                std::istringstream iss(req(0).value());
-                iss >> side;
+                util::to_x(req(0).value(), side);
                 res = {200, "OK"};
                 Rect r = getRect(side);
                 res(0) = r.width;
@@ -250,8 +289,7 @@ bool Ayu::init() {
             }
             else if (event == "GetBalloonOffset" && req(0)) {
                 int side;
-                std::istringstream iss(req(0).value());
-                iss >> side;
+                util::to_x(req(0).value(), side);
                 res = {200, "OK"};
                 auto offset = getBalloonOffset(side);
                 res(0) = static_cast<int>(offset.x);
@@ -262,6 +300,7 @@ bool Ayu::init() {
                 util::to_x(req(0).value(), side);
                 util::to_x(req(1).value(), id);
                 startAnimation(side, id);
+                wakeup = true;
             }
             else if (event == "IsPlayingAnimation" && req(0) && req(1)) {
                 int side, id;
@@ -283,7 +322,7 @@ bool Ayu::init() {
                 }
                 util::to_x(req(0).value(), side);
                 do {
-                    auto key = req(1).value() + "," + req(2).value();
+                    auto key = std::string(req(1).value()) + "," + std::string(req(2).value());
                     if (!bind_id_.contains(side)) {
                         break;
                     }
@@ -291,31 +330,40 @@ bool Ayu::init() {
                         break;
                     }
                     int id = bind_id_.at(side).at(key);
-                    bind(side, id, req(3).value(), flag);
+                    bind(side, id, std::string(req(3).value()), flag);
+                    wakeup = true;
                 } while (false);
             }
             else {
                 std::vector<std::string> args;
-                args.push_back(event);
+                args.emplace_back(event);
                 for (int i = 0; ; i++) {
                     if (req(i)) {
-                        args.push_back(req(i).value());
+                        args.emplace_back(req(i).value());
                     }
                     else {
                         break;
                     }
                 }
-                std::unique_lock<std::mutex> lock(mutex_);
-                queue_.push(args);
+                {
+                    std::unique_lock<std::mutex> lock(mutex_);
+                    queue_.push(args);
+                }
+                wakeup = true;
             }
 
             res["Charset"] = "UTF-8";
 
-            std::string response = res;
-            Logger::log(response);
-            len = response.size();
-            std::cout.write(reinterpret_cast<char *>(&len), sizeof(uint32_t));
-            std::cout.write(response.c_str(), len);
+            // 長さとレスポンスをまとめて1回で書き出す
+            response.assign(sizeof(uint32_t), '\0');
+            res.write(response);
+            len = response.size() - sizeof(uint32_t);
+            memcpy(response.data(), &len, sizeof(uint32_t));
+            Logger::log(std::string_view(response).substr(sizeof(uint32_t)));
+            std::cout.write(response.data(), response.size());
+            if (wakeup) {
+                glfwPostEmptyEvent();
+            }
         }
         {
             std::unique_lock<std::mutex> lock(mutex_);
@@ -323,6 +371,7 @@ bool Ayu::init() {
             event_queue_.push({{"", "", {}}});
         }
         cond_.notify_one();
+        glfwPostEmptyEvent();
     });
 
 #if !defined(DEBUG)
@@ -356,9 +405,25 @@ bool Ayu::init() {
                 list = event_queue_.front();
                 event_queue_.pop();
             }
-            for (auto &request : list) {
-                auto res = sstp::Response::parse(sendDirectSSTP(request.method, request.command, request.args));
-                if (res.getStatusCode() != 204) {
+            int retry = 0;
+            for (size_t i = 0; i < list.size();) {
+                auto &request = list[i];
+                auto data = sendDirectSSTP(request.method, request.command, request.args);
+                sstp::ResponseView res(data);
+                if (res.getStatusCode() == 204) {
+                    i++;
+                    retry = 0;
+                    continue;
+                }
+                // 接続できずに送れなかった場合は繋ぎ直せるまで待って送り直す
+                auto wait = pool_->backoff();
+                if (!wait || retry >= send_retry) {
+                    break;
+                }
+                retry++;
+                std::this_thread::sleep_until(wait.value());
+                std::unique_lock<std::mutex> lock(mutex_);
+                if (!alive_) {
                     break;
                 }
             }
@@ -377,6 +442,9 @@ bool Ayu::init() {
 wl_compositor *Ayu::getCompositor() {
     return compositor;
 }
+wl_subcompositor *Ayu::getSubcompositor() {
+    return subcompositor;
+}
 zxdg_output_manager_v1 *Ayu::getManager() {
     return manager;
 }
@@ -387,8 +455,9 @@ std::string Ayu::getInfo(std::string key, bool fallback) {
         return info_.at(key);
     }
     if (fallback) {
-        auto res = sstp::Response::parse(Ayu::sendDirectSSTP("EXECUTE", "GetSurfaceInfo", {key}));
-        std::string content = res.getContent();
+        auto data = Ayu::sendDirectSSTP("EXECUTE", "GetSurfaceInfo", {key});
+        sstp::ResponseView res(data);
+        std::string content(res.getContent());
         if (content.empty()) {
             Logger::log("info(", key, "): not found");
             return "";
@@ -468,8 +537,24 @@ void Ayu::clearCache() {
 }
 
 void Ayu::draw() {
-    //glfwPollEvents();
-    glfwWaitEventsTimeout(0.001); // 1ms
+    // 次にアニメーションが進むまで眠る
+    // 入力イベントかth_recv_からのglfwPostEmptyEventで起こされる
+    std::optional<int> timeout = std::nullopt;
+    for (auto &[_, v] : characters) {
+        auto t = v->remain();
+        if (t && (!timeout || t.value() < timeout.value())) {
+            timeout = t;
+        }
+    }
+    if (!timeout) {
+        glfwWaitEvents();
+    }
+    else if (timeout.value() <= 0) {
+        glfwPollEvents();
+    }
+    else {
+        glfwWaitEventsTimeout(timeout.value() / 1000.0);
+    }
     assert(glfwGetError(nullptr) == GLFW_NO_ERROR);
     std::queue<std::vector<std::string>> queue;
     {
@@ -517,6 +602,11 @@ void Ayu::draw() {
     for (auto k : keys) {
         characters[k]->draw(cache_, changed);
     }
+    // 描き終えてから次に起きるまでの間に少しずつ先読みする
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(prefetch_budget);
+    for (auto k : keys) {
+        characters[k]->prefetch(cache_, deadline);
+    }
 }
 
 Rect Ayu::getRect(int side) {
@@ -601,41 +691,15 @@ std::string Ayu::sendDirectSSTP(std::string method, std::string command, std::ve
     for (int i = 0; i < args.size(); i++) {
         req(i) = args[i];
     }
-    sockaddr_un addr;
-    if (path_.length() >= sizeof(addr.sun_path)) {
-        return res;
-    }
-    int soc = socket(AF_UNIX, SOCK_STREAM, 0);
-    if (soc == -1) {
-        return res;
-    }
-    memset(&addr, 0, sizeof(sockaddr_un));
-    addr.sun_family = AF_UNIX;
-    // null-terminatedも書き込ませる
-    strncpy(addr.sun_path, path_.c_str(), path_.length() + 1);
-    if (connect(soc, reinterpret_cast<const sockaddr *>(&addr), sizeof(addr)) == -1) {
+    // スレッド毎に送信バッファを使い回す
+    thread_local std::string request;
+    request.clear();
+    req.write(request);
+    auto data = pool_->request(path_, request);
+    if (!data) {
         return res;
     }
-    std::string request = req;
-    if (send(soc, request.c_str(), request.size(), 0) != request.size()) {
-        closesocket(soc);
-        return res;
-    }
-    char buffer[BUFFER_SIZE] = {};
-    std::string data;
-    while (true) {
-        int ret = recv(soc, buffer, BUFFER_SIZE, 0);
-        if (ret == -1) {
-            closesocket(soc);
-            return res;
-        }
-        if (ret == 0) {
-            closesocket(soc);
-            break;
-        }
-        data.append(buffer, ret);
-    }
-    return data;
+    return data.value();
 }
 
 void Ayu::enqueueDirectSSTP(std::vector<Request> list) {
@@ -21,6 +21,8 @@
 #endif // USE_WAYLAND
 
 #include "character.h"
+#include "connection_pool.h"
+#include "event_queue.h"
 #include "image_cache.h"
 #include "misc.h"
 #include "surfaces.h"
@@ -35,7 +37,7 @@ class Ayu {
         std::mutex mutex_;
         std::condition_variable cond_;
         std::queue<std::vector<std::string>> queue_;
-        std::queue<std::vector<Request>> event_queue_;
+        EventQueue event_queue_;
         std::unique_ptr<std::thread> th_recv_;
         std::unique_ptr<std::thread> th_send_;
         std::filesystem::path ayu_dir_;
@@ -44,6 +46,7 @@ class Ayu {
         std::unique_ptr<Surfaces> surfaces_;
         std::unordered_map<CursorType, GLFWcursor *> cursors_;
         std::unique_ptr<ImageCache> cache_;
+        std::unique_ptr<ConnectionPool> pool_;
         std::string path_;
         std::string uuid_;
         bool alive_;
@@ -51,7 +54,7 @@ class Ayu {
         bool loaded_;
 
     public:
-        Ayu() : alive_(true), scale_(100), loaded_(false) {
+        Ayu() : pool_(std::make_unique<ConnectionPool>()), alive_(true), scale_(100), loaded_(false) {
             init();
 #if defined(DEBUG)
             ayu_dir_ = "./shell/master";
@@ -68,6 +71,7 @@ class Ayu {
 
 #if defined(USE_WAYLAND)
         wl_compositor *getCompositor();
+        wl_subcompositor *getSubcompositor();
         zxdg_output_manager_v1 *getManager();
 #endif
 
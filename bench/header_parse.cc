@@ -0,0 +1,144 @@
+// ヘッダ解析のマイクロベンチマーク
+// 以前のregexを使った実装と、現在のRequest/Response、
+// string_viewを使うRequestView/ResponseViewを比べる
+//
+// make bench && ./bench/header_parse
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <regex>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+
+#include "ayu.h"
+#include "sstp.h"
+
+namespace legacy {
+    // 以前のbase::Header/Request/Response::parseと同じ処理
+    std::unordered_map<std::string, std::string> parseHeader(std::istringstream &iss) {
+        std::unordered_map<std::string, std::string> map;
+        std::string header;
+        while (std::getline(iss, header, '\x0a') && !header.empty()) {
+            auto pos = header.find(':');
+            if (pos == std::string::npos) {
+                continue;
+            }
+            map[header.substr(0, pos)] = header.substr(pos + 2);
+        }
+        return map;
+    }
+
+    size_t parseRequest(std::string str, const char *protocol_name) {
+        str.erase(std::remove_if(str.begin(), str.end(), [](int ch) { return ch == '\x0d'; }), str.end());
+        std::istringstream iss(str);
+        std::string line;
+        getline(iss, line, '\x0a');
+        auto pos = line.rfind(' ');
+        if (pos == std::string::npos) {
+            return 0;
+        }
+        std::string protocol = line.substr(pos + 1);
+        std::ostringstream pattern;
+        pattern << protocol_name << R"(/\d+\.\d+)";
+        if (!regex_match(protocol, std::regex(pattern.str()))) {
+            return 0;
+        }
+        return parseHeader(iss).size();
+    }
+
+    size_t parseResponse(std::string str, const char *protocol_name) {
+        str.erase(std::remove_if(str.begin(), str.end(), [](int ch) { return ch == '\x0d'; }), str.end());
+        std::istringstream iss(str);
+        std::string line;
+        getline(iss, line, '\x0a');
+        auto pos = line.find(' ');
+        if (pos == std::string::npos) {
+            return 0;
+        }
+        std::string protocol = line.substr(0, pos);
+        std::ostringstream pattern;
+        pattern << protocol_name << R"(/\d+\.\d+)";
+        if (!regex_match(protocol, std::regex(pattern.str()))) {
+            return 0;
+        }
+        auto size = parseHeader(iss).size();
+        std::string content;
+        std::getline(iss, content, '\x0a');
+        return size + content.size();
+    }
+}
+
+namespace {
+    const std::string request =
+        "EXECUTE AYU/0.9\x0d\x0a"
+        "Charset: UTF-8\x0d\x0a"
+        "Command: UpdateInfo\x0d\x0a"
+        "Argument0: 4\x0d\x0a"
+        "Argument1: sakura.name,Sakura\x0d\x0a"
+        "Argument2: kero.name,Unyu\x0d\x0a"
+        "Argument3: sakura.bindgroup10.name,Clothes,Ribbon\x0d\x0a"
+        "Argument4: seriko.alignmenttodesktop,bottom\x0d\x0a"
+        "\x0d\x0a";
+
+    const std::string response =
+        "SSTP/1.4 200 OK\x0d\x0a"
+        "Charset: UTF-8\x0d\x0a"
+        "Sender: ninix\x0d\x0a"
+        "Script: \\0\\s[0]\\e\x0d\x0a"
+        "\x0d\x0a"
+        "320,240\x0d\x0a"
+        "\x0d\x0a";
+
+    // 最適化で消されないように結果を足しておく
+    volatile size_t sink;
+
+    template<typename F>
+    void run(const char *name, int n, F f) {
+        size_t sum = 0;
+        auto begin = std::chrono::steady_clock::now();
+        for (int i = 0; i < n; i++) {
+            sum += f();
+        }
+        auto end = std::chrono::steady_clock::now();
+        sink = sum;
+        double ns = std::chrono::duration<double, std::nano>(end - begin).count() / n;
+        std::printf("%-28s %10.1f ns/op\n", name, ns);
+    }
+}
+
+int main(int argc, char **argv) {
+    int n = 200000;
+    if (argc > 1) {
+        n = std::atoi(argv[1]);
+    }
+
+    run("legacy Request::parse", n, [] {
+        return legacy::parseRequest(request, ayu::protocol_name);
+    });
+    run("Request::parse", n, [] {
+        auto req = ayu::Request::parse(request);
+        return static_cast<size_t>(!!req(0));
+    });
+    ayu::RequestView req_view;
+    run("RequestView::parse", n, [&] {
+        req_view.parse(request);
+        return static_cast<size_t>(!!req_view(0));
+    });
+
+    run("legacy Response::parse", n, [] {
+        return legacy::parseResponse(response, sstp::protocol_name);
+    });
+    run("Response::parse", n, [] {
+        auto res = sstp::Response::parse(response);
+        return res.getContent().size();
+    });
+    sstp::ResponseView res_view;
+    run("ResponseView::parse", n, [&] {
+        res_view.parse(response);
+        return res_view.getContent().size();
+    });
+
+    return 0;
+}
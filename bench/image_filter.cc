@@ -0,0 +1,258 @@
+// 画像の前処理のマイクロベンチマーク
+// 以前のImageCacheで行っていたスカラーの処理と、
+// image_filterの各命令セット版を比べ、結果が一致するかも確かめる
+// 画像を渡さなければ人工的に作った画像を使う
+//
+// make bench && ./bench/image_filter [surface0000.png ...]
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#define STB_IMAGE_IMPLEMENTATION
+#include <stb_image.h>
+
+#include "image_filter.h"
+
+namespace legacy {
+    // 以前のImageCache::getOriginalと同じ処理
+    void clear(const unsigned char *p, unsigned char *data, int w, int h) {
+        for (int i = 0; i < w * h; i++) {
+            if (p[4 * i + 3] == 0) {
+                data[4 * i + 0] = 0;
+                data[4 * i + 1] = 0;
+                data[4 * i + 2] = 0;
+                data[4 * i + 3] = 0;
+            }
+            else {
+                data[4 * i + 0] = p[4 * i + 0];
+                data[4 * i + 1] = p[4 * i + 1];
+                data[4 * i + 2] = p[4 * i + 2];
+                data[4 * i + 3] = p[4 * i + 3];
+            }
+        }
+    }
+
+    void colorKey(unsigned char *data, int w, int h) {
+        int r = data[0 + 0];
+        int g = data[0 + 1];
+        int b = data[0 + 2];
+        for (int i = 0; i < w * h; i++) {
+            if (data[4 * i + 0] == r && data[4 * i + 1] == g && data[4 * i + 2] == b) {
+                data[4 * i + 0] = 0;
+                data[4 * i + 1] = 0;
+                data[4 * i + 2] = 0;
+                data[4 * i + 3] = 0;
+            }
+        }
+    }
+
+    void bleed(unsigned char *data, int w, int h) {
+        std::vector<unsigned char> blurred;
+        blurred.resize(w * h * 4);
+        const int blur[3][3] = {
+            {1, 2, 1},
+            {2, 4, 2},
+            {1, 2, 1},
+        };
+        auto in = [](int x, int y, int w, int h) {
+            if (x < 0) {
+                return false;
+            }
+            if (y < 0) {
+                return false;
+            }
+            if (x >= w) {
+                return false;
+            }
+            if (y >= h) {
+                return false;
+            }
+            return true;
+        };
+        for (int y = 0; y < h; y++) {
+            for (int x = 0; x < w; x++) {
+                double n = 0.0;
+                int sum[4] = {};
+                for (int j = -1; j <= 1; j++) {
+                    for (int i = -1; i <= 1; i++) {
+                        if (in(x + i, y + j, w, h)) {
+                            int index = 4 * ((y + j) * w + (x + i));
+                            if (data[index + 3] == 0) {
+                                continue;
+                            }
+                            auto factor = blur[1 + j][1 + i];
+                            n += factor;
+                            sum[0] += data[index + 0] * factor;
+                            sum[1] += data[index + 1] * factor;
+                            sum[2] += data[index + 2] * factor;
+                            sum[3] += data[index + 3] * factor;
+                        }
+                    }
+                }
+                int index = 4 * (y * w + x);
+                blurred[index + 0] = std::min(255.0, std::ceil(sum[0] / n));
+                blurred[index + 1] = std::min(255.0, std::ceil(sum[1] / n));
+                blurred[index + 2] = std::min(255.0, std::ceil(sum[2] / n));
+                blurred[index + 3] = std::min(255.0, std::ceil(sum[3] / n));
+            }
+        }
+        for (int i = 0; i < w * h; i++) {
+            if (blurred[4 * i + 3] > 0 && data[4 * i + 3] == 0) {
+                data[4 * i + 0] = blurred[4 * i + 0];
+                data[4 * i + 1] = blurred[4 * i + 1];
+                data[4 * i + 2] = blurred[4 * i + 2];
+            }
+        }
+    }
+}
+
+namespace {
+    struct Image {
+        std::string name;
+        int w, h;
+        std::vector<unsigned char> pixels;
+    };
+
+    // 単色の背景に楕円の立ち絵を置いたもの
+    // 背景は透過色で抜き、縁にはalpha=0の画素を混ぜる
+    Image synthetic(int w, int h) {
+        Image image = {"synthetic", w, h, std::vector<unsigned char>(w * h * 4)};
+        unsigned int seed = 1;
+        for (int y = 0; y < h; y++) {
+            for (int x = 0; x < w; x++) {
+                auto p = &image.pixels[4 * (y * w + x)];
+                double dx = (x - w / 2.0) / (w * 0.35), dy = (y - h / 2.0) / (h * 0.45);
+                double d = dx * dx + dy * dy;
+                seed = seed * 1103515245 + 12345;
+                if (d > 1.0) {
+                    p[0] = 0;
+                    p[1] = 255;
+                    p[2] = 0;
+                    p[3] = 255;
+                }
+                else {
+                    p[0] = x * 255 / w;
+                    p[1] = y * 255 / h;
+                    p[2] = (seed >> 16) & 0xff;
+                    p[3] = (d > 0.9 && (seed >> 24) % 3 == 0) ? 0 : 255;
+                }
+            }
+        }
+        return image;
+    }
+
+    // 最適化で消されないように結果を足しておく
+    volatile size_t sink;
+
+    template<typename F>
+    void run(const char *name, int n, double megapixels, F f) {
+        size_t sum = 0;
+        auto begin = std::chrono::steady_clock::now();
+        for (int i = 0; i < n; i++) {
+            sum += f();
+        }
+        auto end = std::chrono::steady_clock::now();
+        sink = sum;
+        double ms = std::chrono::duration<double, std::milli>(end - begin).count() / n / megapixels;
+        std::printf("%-28s %10.3f ms/MP\n", name, ms);
+    }
+
+    const char *isaName(image_filter::Isa isa) {
+        switch (isa) {
+            case image_filter::Isa::AVX2:
+                return "avx2";
+            case image_filter::Isa::SSE41:
+                return "sse4.1";
+            default:
+                return "scalar";
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+    int n = 20;
+    std::vector<Image> images;
+    for (int i = 1; i < argc; i++) {
+        int w, h, _bpp;
+        unsigned char *p = stbi_load(argv[i], &w, &h, &_bpp, 4);
+        if (p == nullptr) {
+            std::fprintf(stderr, "failed to load %s\n", argv[i]);
+            continue;
+        }
+        images.push_back({argv[i], w, h, std::vector<unsigned char>(p, p + w * h * 4)});
+        stbi_image_free(p);
+    }
+    if (images.empty()) {
+        images.push_back(synthetic(1024, 1024));
+    }
+
+    const image_filter::Isa isas[] = {
+        image_filter::Isa::Scalar, image_filter::Isa::SSE41, image_filter::Isa::AVX2,
+    };
+    int ret = 0;
+    for (auto &image : images) {
+        int w = image.w, h = image.h;
+        double mp = w * h / 1e6;
+        std::printf("%s (%dx%d)\n", image.name.c_str(), w, h);
+        const unsigned char *src = image.pixels.data();
+
+        // 期待する結果
+        std::vector<unsigned char> expected(w * h * 4);
+        legacy::clear(src, expected.data(), w, h);
+        legacy::colorKey(expected.data(), w, h);
+        legacy::bleed(expected.data(), w, h);
+
+        std::vector<unsigned char> data(w * h * 4);
+        run("legacy clear", n, mp, [&] {
+            legacy::clear(src, data.data(), w, h);
+            return data[0];
+        });
+        run("legacy colorKey", n, mp, [&] {
+            legacy::colorKey(data.data(), w, h);
+            return data[0];
+        });
+        // 伝播させる画素は元のalphaだけで決まるので繰り返しても同じ処理になる
+        run("legacy bleed", n, mp, [&] {
+            legacy::bleed(data.data(), w, h);
+            return data[0];
+        });
+
+        for (auto isa : isas) {
+            if (!image_filter::use(isa)) {
+                continue;
+            }
+            std::string name = isaName(isa);
+            run((name + " clearTransparent").c_str(), n, mp, [&] {
+                image_filter::clearTransparent(src, data.data(), w * h);
+                return data[0];
+            });
+            run((name + " colorKey").c_str(), n, mp, [&] {
+                image_filter::colorKey(data.data(), w * h);
+                return data[0];
+            });
+            run((name + " bleed").c_str(), n, mp, [&] {
+                image_filter::bleed(data.data(), w, h);
+                return data[0];
+            });
+
+            std::vector<unsigned char> actual(w * h * 4);
+            image_filter::clearTransparent(src, actual.data(), w * h);
+            image_filter::colorKey(actual.data(), w * h);
+            image_filter::bleed(actual.data(), w, h);
+            if (actual != expected) {
+                auto it = std::mismatch(actual.begin(), actual.end(), expected.begin());
+                size_t i = (it.first - actual.begin()) / 4;
+                std::printf("%s: mismatch at (%zu, %zu)\n", name.c_str(), i % w, i / w);
+                ret = 1;
+            }
+        }
+        image_filter::use(image_filter::detect());
+    }
+
+    return ret;
+}
@@ -1,15 +1,22 @@
 #include "character.h"
 
+#include <cassert>
+
 #include "sstp.h"
 #include "util.h"
 
+namespace {
+    // 描画が完了していない(超解像待ちなど)場合に再描画を試みる間隔(ms)
+    const int retry_interval = 50;
+}
+
 Character::Character(Ayu *parent, int side, const std::string &name, std::unique_ptr<Seriko> seriko)
     : parent_(parent), side_(side), name_(name),
     seriko_(std::move(seriko)),
     rect_({0, 0, 0, 0}), balloon_offset_({0, 0}),
     balloon_direction_(false), id_(-1), once_(true),
     reset_balloon_position_(false), current_cursor_type_(CursorType::Default),
-    position_changed_(false), upconverted_(false) {
+    position_changed_(false), upconverted_(false), prefetch_requested_(false) {
     seriko_->setParent(this);
 }
 
@@ -27,23 +34,33 @@ void Character::destroy(GLFWmonitor *monitor) {
 }
 
 void Character::draw(std::unique_ptr<ImageCache> &cache, bool changed) {
+    // アニメーションが進まず位置も変わらないなら何もしない
+    // 当たり判定などで描画の外で進んだ分はgenerationで分かる
+    if (prev_ && prev_.value() == seriko_->generation() && !changed && !position_changed_ && upconverted_ && !seriko_->needsUpdate(id_)) {
+        // 表示しているのは今のサーフェス(無ければ空)のもの
+        assert(seriko_->listId() == id_);
+        return;
+    }
     bool use_self_alpha = (parent_->getInfo("seriko.use_self_alpha", false) == "1");
-    auto list = seriko_->get(id_);
+    auto &list = seriko_->get(id_);
     if (changed) {
         upconverted_ = false;
         requestAdjust();
     }
-    if (!prev_ || !(prev_.value() == list) || position_changed_ || changed || !upconverted_) {
+    if (!prev_ || prev_.value() != seriko_->generation() || position_changed_ || changed || !upconverted_) {
         position_changed_ = false;
-        prev_ = list;
+        prev_ = seriko_->generation();
         bool upconverted = true;
+        // 描き変えた範囲を覚えているので全てのウィンドウで描く
         for (auto &[_, v] : windows_) {
+            bool drawn;
             if (util::isWayland()) {
-                upconverted = upconverted && v->draw(cache, {rect_.x, rect_.y}, list, use_self_alpha);
+                drawn = v->draw(cache, {rect_.x, rect_.y}, list, use_self_alpha);
             }
             else {
-                upconverted = upconverted && v->draw(cache, {0, 0}, list, use_self_alpha);
+                drawn = v->draw(cache, {0, 0}, list, use_self_alpha);
             }
+            upconverted = upconverted && drawn;
         }
         upconverted_ = upconverted;
         for (auto &[_, v] : windows_) {
@@ -52,6 +69,36 @@ void Character::draw(std::unique_ptr<ImageCache> &cache, bool changed) {
     }
 }
 
+// 次のサーフェスで使いそうな画像を読み込み、テクスチャにしておく
+// 読み込みは先に全て依頼しておき、テクスチャは期限までに作れる分だけ作る
+void Character::prefetch(std::unique_ptr<ImageCache> &cache, std::chrono::steady_clock::time_point deadline) {
+    if (prefetch_.empty()) {
+        return;
+    }
+    if (!prefetch_requested_) {
+        prefetch_requested_ = true;
+        for (auto &e : prefetch_) {
+            cache->request(e.image);
+        }
+    }
+    bool use_self_alpha = (parent_->getInfo("seriko.use_self_alpha", false) == "1");
+    bool done = true;
+    for (auto &[_, v] : windows_) {
+        done = v->prefetch(cache, prefetch_, use_self_alpha, deadline) && done;
+    }
+    if (done) {
+        prefetch_.clear();
+    }
+}
+
+std::optional<int> Character::remain() {
+    auto ret = seriko_->remain(id_);
+    if ((!upconverted_ || !prefetch_.empty()) && (!ret || ret.value() > retry_interval)) {
+        ret = retry_interval;
+    }
+    return ret;
+}
+
 void Character::show(bool force) {
     for (auto &[_, v] : windows_) {
         v->show(force);
@@ -65,6 +112,10 @@ void Character::hide() {
 }
 
 void Character::setSurface(int id) {
+    if (id != id_) {
+        prefetch_ = seriko_->prefetch(id);
+        prefetch_requested_ = false;
+    }
     id_ = id;
     if (id_ >= 0 && once_) {
         once_ = false;
@@ -113,6 +164,7 @@ void Character::bind(int id, std::string from, BindFlag flag) {
 }
 
 void Character::clearCache() {
+    prefetch_requested_ = false;
     for (auto &[_, v] : windows_) {
         v->clearCache();
     }
@@ -480,6 +532,10 @@ wl_compositor *Character::getCompositor() {
     return parent_->getCompositor();
 }
 
+wl_subcompositor *Character::getSubcompositor() {
+    return parent_->getSubcompositor();
+}
+
 zxdg_output_manager_v1 *Character::getManager() {
     return parent_->getManager();
 }
@@ -3,6 +3,8 @@
 
 #include "glad/glad.h"
 #include <GLFW/glfw3.h>
+#include <chrono>
+#include <cstdint>
 #include <memory>
 #include <optional>
 
@@ -36,15 +38,21 @@ class Character {
         bool reset_balloon_position_;
         CursorType current_cursor_type_;
         std::mutex mutex_;
-        std::optional<std::vector<RenderInfo>> prev_;
+        // 前回描画した時のSerikoのgeneration
+        std::optional<uint64_t> prev_;
         bool position_changed_;
         bool upconverted_;
+        // 切り替えたサーフェスで描かれ得る要素
+        std::vector<Element> prefetch_;
+        bool prefetch_requested_;
     public:
         Character(Ayu *parent, int side, const std::string &name, std::unique_ptr<Seriko> seriko);
         ~Character();
         void create(GLFWmonitor *monitor);
         void destroy(GLFWmonitor *monitor);
         void draw(std::unique_ptr<ImageCache> &cache, bool changed);
+        void prefetch(std::unique_ptr<ImageCache> &cache, std::chrono::steady_clock::time_point deadline);
+        std::optional<int> remain();
         int side() const {
             return side_;
         }
@@ -100,6 +108,7 @@ class Character {
         std::unordered_set<int> getBindAddId(int id);
 #if defined(USE_WAYLAND)
         wl_compositor *getCompositor();
+        wl_subcompositor *getSubcompositor();
         zxdg_output_manager_v1 *getManager();
 #endif // USE_WAYLAND
 };
@@ -0,0 +1,259 @@
+#include "connection_pool.h"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(_WIN32) || defined(WIN32)
+#include <ws2tcpip.h>
+#include <afunix.h>
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#undef max
+#undef min
+#else
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif // WIN32
+
+#include "logger.h"
+#include "util.h"
+
+namespace {
+#if defined(_WIN32) || defined(WIN32)
+    const int MSG_NOSIGNAL = 0;
+    inline int poll(pollfd *fds, unsigned long n, int timeout) {
+        return WSAPoll(fds, n, timeout);
+    }
+#else
+    inline int closesocket(int fd) {
+        return close(fd);
+    }
+#endif
+    // 保持しておく接続の最大数
+    const size_t max_idle = 4;
+    // 200 OKのレスポンスの後に続く内容を待つ時間(ms)
+    const int content_wait = 5;
+    // ヘッダを読み終えるまで待つ時間(ms)
+    const int response_timeout = 3000;
+    // 接続に失敗した時の待ち時間(ms)
+    const int backoff_min = 10;
+    const int backoff_max = 1000;
+
+    enum class Progress {
+        Incomplete, Header, Complete,
+    };
+
+    // 接続を維持したまま読む時はEOFが来ないので
+    // ヘッダ(200ならその後の内容)の終わりまで読めたかで判断する
+    // ヘッダだけ読めていればHeader
+    Progress progress(const std::string &data) {
+        auto pos = data.find("\x0d\x0a\x0d\x0a");
+        if (pos == std::string::npos) {
+            return Progress::Incomplete;
+        }
+        auto sp = data.find(' ');
+        if (sp == std::string::npos || data.compare(sp + 1, 3, "200") != 0) {
+            return Progress::Complete;
+        }
+        if (data.size() > pos + 4 && data.find("\x0d\x0a\x0d\x0a", pos + 4) != std::string::npos) {
+            return Progress::Complete;
+        }
+        return Progress::Header;
+    }
+
+    bool sendAll(int soc, const std::string &data) {
+        size_t sent = 0;
+        while (sent < data.size()) {
+            auto ret = send(soc, data.c_str() + sent, data.size() - sent, MSG_NOSIGNAL);
+            if (ret <= 0) {
+                return false;
+            }
+            sent += ret;
+        }
+        return true;
+    }
+}
+
+ConnectionPool::~ConnectionPool() {
+    closeAll();
+}
+
+std::optional<std::string> ConnectionPool::request(const std::string &path, const std::string &data) {
+    // 使い回した接続が既に切られていた場合は1度だけ繋ぎ直す
+    for (int i = 0; i < 2; i++) {
+        bool reused = false;
+        auto soc = acquire(path, reused);
+        if (!soc) {
+            return std::nullopt;
+        }
+        std::string response;
+        bool closed = false;
+        bool framed = false;
+        bool sent = sendAll(soc.value(), data);
+        if (!sent || !receive(soc.value(), response, closed, framed) ||
+                (closed && response.empty())) {
+            closesocket(soc.value());
+            // 届いていないと分かる場合だけ送り直す
+            // 時間切れなどはベースウェアが処理している最中かもしれず
+            // 送り直すとNOTIFYが2回届くことになる
+            bool undelivered = !sent || (closed && response.empty());
+            if (reused && undelivered) {
+                std::unique_lock<std::mutex> lock(mutex_);
+                // 保持している接続も全て切られているはず
+                // 以降はリクエスト毎に接続する
+                keep_alive_ = false;
+                for (auto s : idle_) {
+                    closesocket(s);
+                }
+                idle_.clear();
+                continue;
+            }
+            return std::nullopt;
+        }
+        if (!closed && !framed) {
+            // 終わりを待ちきれなかったので後から続きが届くかもしれない
+            // 次のリクエストのレスポンスと混ざらないように使い回さない
+            closesocket(soc.value());
+        }
+        else {
+            release(soc.value(), closed);
+        }
+        return response;
+    }
+    return std::nullopt;
+}
+
+std::optional<std::chrono::steady_clock::time_point> ConnectionPool::backoff() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (failure_ > 0 && std::chrono::steady_clock::now() < retry_) {
+        return retry_;
+    }
+    return std::nullopt;
+}
+
+std::optional<int> ConnectionPool::acquire(const std::string &path, bool &reused) {
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (path_ != path) {
+            closeAll();
+            path_ = path;
+            keep_alive_ = true;
+            failure_ = 0;
+        }
+        if (!idle_.empty()) {
+            int soc = idle_.back();
+            idle_.pop_back();
+            reused = true;
+            return soc;
+        }
+        if (failure_ > 0 && std::chrono::steady_clock::now() < retry_) {
+            return std::nullopt;
+        }
+    }
+    int soc = connect(path);
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (soc == -1) {
+        int wait = std::min(backoff_max, backoff_min << std::min(failure_, 7));
+        failure_++;
+        retry_ = std::chrono::steady_clock::now() + std::chrono::milliseconds(wait);
+        Logger::log("SSTP: connect failed, retry after ", wait, "ms");
+        return std::nullopt;
+    }
+    failure_ = 0;
+    return soc;
+}
+
+void ConnectionPool::release(int soc, bool closed) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (closed) {
+        // レスポンス毎に切断するベースウェア
+        keep_alive_ = false;
+        closesocket(soc);
+    }
+    else if (keep_alive_ && idle_.size() < max_idle) {
+        idle_.push_back(soc);
+    }
+    else {
+        closesocket(soc);
+    }
+}
+
+int ConnectionPool::connect(const std::string &path) {
+    sockaddr_un addr;
+    if (path.length() >= sizeof(addr.sun_path)) {
+        return -1;
+    }
+    int soc = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (soc == -1) {
+        return -1;
+    }
+    memset(&addr, 0, sizeof(sockaddr_un));
+    addr.sun_family = AF_UNIX;
+    // null-terminatedも書き込ませる
+    strncpy(addr.sun_path, path.c_str(), path.length() + 1);
+    if (::connect(soc, reinterpret_cast<const sockaddr *>(&addr), sizeof(addr)) == -1) {
+        closesocket(soc);
+        return -1;
+    }
+    return soc;
+}
+
+// 読む度に待つ時間を決めておき、ベースウェアが応答しなくても戻る
+// framedはレスポンスの終わりまで読めたと分かっている場合にtrue
+bool ConnectionPool::receive(int soc, std::string &data, bool &closed, bool &framed) {
+    bool keep_alive;
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        keep_alive = keep_alive_;
+    }
+    char buffer[BUFFER_SIZE];
+    closed = false;
+    framed = false;
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(response_timeout);
+    while (true) {
+        auto p = progress(data);
+        if (keep_alive && p == Progress::Complete) {
+            framed = true;
+            return true;
+        }
+        int timeout;
+        if (p == Progress::Incomplete || !keep_alive) {
+            timeout = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+            timeout = std::max(0, timeout);
+        }
+        else {
+            timeout = content_wait;
+        }
+        pollfd fd = {soc, POLLIN, 0};
+        int ret = poll(&fd, 1, timeout);
+        if (ret == -1) {
+            return false;
+        }
+        if (ret == 0) {
+            if (p == Progress::Incomplete) {
+                Logger::log("SSTP: response timed out");
+                return false;
+            }
+            return true;
+        }
+        ret = recv(soc, buffer, BUFFER_SIZE, 0);
+        if (ret == -1) {
+            return false;
+        }
+        if (ret == 0) {
+            closed = true;
+            framed = true;
+            return true;
+        }
+        data.append(buffer, ret);
+    }
+}
+
+void ConnectionPool::closeAll() {
+    for (auto soc : idle_) {
+        closesocket(soc);
+    }
+    idle_.clear();
+}
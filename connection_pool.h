@@ -0,0 +1,36 @@
+#ifndef CONNECTION_POOL_H_
+#define CONNECTION_POOL_H_
+
+#include <chrono>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+// ベースウェアへのSSTP接続を使い回す
+// ベースウェアがレスポンス毎に切断する場合は
+// 従来通りリクエスト毎に接続する
+class ConnectionPool {
+    private:
+        std::mutex mutex_;
+        std::string path_;
+        std::vector<int> idle_;
+        bool keep_alive_;
+        int failure_;
+        std::chrono::steady_clock::time_point retry_;
+
+        std::optional<int> acquire(const std::string &path, bool &reused);
+        void release(int soc, bool closed);
+        int connect(const std::string &path);
+        bool receive(int soc, std::string &data, bool &closed, bool &framed);
+        void closeAll();
+
+    public:
+        ConnectionPool() : keep_alive_(true), failure_(0) {}
+        ~ConnectionPool();
+        std::optional<std::string> request(const std::string &path, const std::string &data);
+        // 接続に失敗して繋ぎ直しを待っている間は再び試せる時刻を返す
+        std::optional<std::chrono::steady_clock::time_point> backoff();
+};
+
+#endif // CONNECTION_POOL_H_
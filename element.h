@@ -2,16 +2,29 @@
 #define ELEMENT_H_
 
 #include <variant>
+#include <vector>
 
 #include "surface.h"
+#include "util.h"
 
 struct ElementWithChildren {
     Method method;
     int x, y;
     std::vector<std::variant<Element, ElementWithChildren>> children;
+    // 子のハッシュは作った時点で求まっているので
+    // 木の深さによらず直下の子の数だけで計算できる
+    size_t hash;
+    ElementWithChildren(Method method, int x, int y, std::vector<std::variant<Element, ElementWithChildren>> children)
+        : method(method), x(x), y(y), children(std::move(children)), hash(static_cast<size_t>(method)) {
+        util::hashCombine(hash, x);
+        util::hashCombine(hash, y);
+        for (auto &child : this->children) {
+            util::hashCombine(hash, std::visit([](const auto &e) { return e.hash; }, child));
+        }
+    }
     bool operator==(const ElementWithChildren &rhs) const {
         const auto &lhs = *this;
-        if (!(lhs.method == rhs.method && lhs.x == rhs.x && lhs.y == rhs.y)) {
+        if (!(lhs.hash == rhs.hash && lhs.method == rhs.method && lhs.x == rhs.x && lhs.y == rhs.y)) {
             return false;
         }
         if (rhs.children.size() != lhs.children.size()) {
@@ -47,21 +60,11 @@ using RenderInfo = std::variant<Element, ElementWithChildren>;
 template<>
 struct std::hash<std::vector<RenderInfo>> {
     size_t operator()(const std::vector<RenderInfo> &infos) const {
-        std::ostringstream oss;
+        size_t ret = infos.size();
         for (auto &info : infos) {
-            if (std::holds_alternative<Element>(info)) {
-                auto &e = std::get<Element>(info);
-                oss << std::hash<Element>()(e);
-            }
-            else if (std::holds_alternative<ElementWithChildren>(info)) {
-                auto &e = std::get<ElementWithChildren>(info);
-                oss << std::hash<Method>()(e.method);
-                oss << std::hash<int>()(e.x);
-                oss << std::hash<int>()(e.y);
-                oss << (*this)(e.children);
-            }
+            util::hashCombine(ret, std::visit([](const auto &e) { return e.hash; }, info));
         }
-        return std::hash<std::string>()(oss.str());
+        return ret;
     }
 };
 
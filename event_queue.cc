@@ -0,0 +1,47 @@
+#include "event_queue.h"
+
+#include <unordered_set>
+
+namespace {
+    // 最新のものだけ送れば十分なコマンド
+    const std::unordered_set<std::string> coalesce = {
+        "UpdateMonitorRect",
+        "UpdateSurfaceRect",
+        "ResetBalloonPosition",
+    };
+
+    std::optional<std::string> key(const std::vector<Request> &list) {
+        if (list.size() != 1) {
+            return std::nullopt;
+        }
+        auto &req = list[0];
+        if (req.method != "EXECUTE" || !coalesce.contains(req.command) || req.args.empty()) {
+            return std::nullopt;
+        }
+        // 第1引数はside
+        return req.command + "," + req.args[0];
+    }
+}
+
+void EventQueue::push(const std::vector<Request> &list) {
+    auto k = key(list);
+    if (k) {
+        // 古いものは捨てて末尾に積み直し、後から積んだものより先に送らない
+        if (slot_.contains(k.value())) {
+            queue_.erase(slot_.at(k.value()));
+        }
+        queue_.push_back({k, list});
+        slot_.insert_or_assign(k.value(), std::prev(queue_.end()));
+    }
+    else {
+        queue_.push_back({std::nullopt, list});
+    }
+}
+
+void EventQueue::pop() {
+    auto &k = queue_.front().key;
+    if (k) {
+        slot_.erase(k.value());
+    }
+    queue_.pop_front();
+}
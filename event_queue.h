@@ -0,0 +1,39 @@
+#ifndef EVENT_QUEUE_H_
+#define EVENT_QUEUE_H_
+
+#include <list>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "misc.h"
+
+// ベースウェアへ送るリクエストのキュー
+// 位置の通知などは側毎・コマンド毎に最新のものだけを積んだ順に残し
+// それ以外(OnMouse*など)は順番通りに送る
+class EventQueue {
+    struct Entry {
+        std::optional<std::string> key;
+        std::vector<Request> list;
+    };
+    private:
+        std::list<Entry> queue_;
+        std::unordered_map<std::string, std::list<Entry>::iterator> slot_;
+    public:
+        EventQueue() {}
+        ~EventQueue() {}
+        void push(const std::vector<Request> &list);
+        void pop();
+        const std::vector<Request> &front() const {
+            return queue_.front().list;
+        }
+        bool empty() const {
+            return queue_.empty();
+        }
+        size_t size() const {
+            return queue_.size();
+        }
+};
+
+#endif // EVENT_QUEUE_H_
@@ -1,75 +1,95 @@
 #include "image_cache.h"
 
+#include <algorithm>
 #include <cassert>
+#include <fstream>
+#include <GLFW/glfw3.h>
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb_image.h>
 #define STB_IMAGE_RESIZE_IMPLEMENTATION
 #include <stb_image_resize2.h>
 
+#include "image_filter.h"
+#include "image_path.h"
 #include "logger.h"
 
-#if defined(USE_ONNX)
+namespace {
+    bool readFile(const std::filesystem::path &path, std::string &out) {
+        std::ifstream ifs(path, std::ios::binary | std::ios::ate);
+        if (!ifs) {
+            return false;
+        }
+        out.resize(static_cast<size_t>(ifs.tellg()));
+        ifs.seekg(0);
+        return !!ifs.read(out.data(), out.size());
+    }
+}
+
 ImageCache::ImageCache(const std::filesystem::path &exe_dir, bool use_self_alpha)
-    : alive_(true), use_self_alpha_(use_self_alpha), scale_(100), session_(nullptr) {
+    : alive_(true), use_self_alpha_(use_self_alpha), scale_(100), epoch_(0)
+{
+    // 描画スレッドを止めないように別スレッドで読み込む
+    unsigned int n = std::clamp(std::thread::hardware_concurrency() / 2, 1u, 4u);
+    for (unsigned int i = 0; i < n; i++) {
+        decoders_.emplace_back([this]() {
+            decode();
+        });
+    }
+#if defined(USE_ONNX)
     std::filesystem::path model_path = exe_dir / "model.onnx";
     try {
-        Ort::SessionOptions session_options;
-        session_ = {env_, model_path.string().c_str(), session_options};
+        upscaler_ = std::make_unique<Upscaler>(model_path);
         th_ = std::make_unique<std::thread>([&]() {
             while (true) {
-                std::filesystem::path p;
+                uint32_t p;
                 int scale;
+                uint64_t digest;
+                std::optional<ImageInfo> info;
                 {
                     std::unique_lock<std::mutex> lock(mutex_);
-                    cond_.wait(lock, [&]() { return !queue_.empty(); });
+                    cond_.wait(lock, [&]() { return !queue_.empty() || !alive_; });
+                    if (!alive_) {
+                        break;
+                    }
                     p = queue_.front();
                     queue_.pop();
                     scale = scale_;
+                    // 読み込みスレッドがcache_orig_を伸ばすことがあるので
+                    // ロック中に取り出しておく
+                    auto &o = slot(cache_orig_, p);
+                    info = o.info;
+                    digest = o.digest;
                 }
-                int num_resize = std::ceil(std::log2(scale_ / 100.0));
-                auto &info = cache_orig_.at(p);
+                if (!info) {
+                    continue;
+                }
+                int num_resize = std::ceil(std::log2(scale / 100.0));
                 int w = info->width();
                 int h = info->height();
                 std::vector<unsigned char> src;
                 std::vector<unsigned char> dest = info->get();
-                for (int i = 0; i < num_resize; i++, w <<= 1, h <<= 1) {
-                    src = dest;
-                    dest.resize(src.size() * 4);
-                    std::array<int64_t, 4> input_shape = {4, 1, h, w};
-                    std::array<int64_t, 4> output_shape = {4, 1, 2 * h, 2 * w};
-                    std::vector<float> input;
-                    input.resize(src.size());
-                    std::vector<float> output;
-                    output.resize(dest.size());
-                    for (int i = 0; i < w * h; i++) {
-                        for (int c = 0; c < 4; c++) {
-                            input[c * w * h + i] = src[4 * i + c] / 255.0;
-                        }
+                try {
+                    for (int i = 0; i < num_resize; i++, w <<= 1, h <<= 1) {
+                        std::swap(src, dest);
+                        upscaler_->upscale(src, w, h, dest);
                     }
-                    auto mem_info = Ort::MemoryInfo::CreateCpu(OrtDeviceAllocator, OrtMemTypeCPU);
-                    Ort::Value input_tensor = Ort::Value::CreateTensor<float>(mem_info, input.data(), input.size(), input_shape.data(), input_shape.size());
-                    Ort::Value output_tensor = Ort::Value::CreateTensor<float>(mem_info, output.data(), output.size(), output_shape.data(), output_shape.size());
-                    const char *input_names[] = {"input"};
-                    const char *output_names[] = {"output"};
-                    Ort::RunOptions run_options;
-                    try {
-                        session_.Run(run_options, input_names, &input_tensor, 1, output_names, &output_tensor, 1);
-                    }
-                    catch (Ort::Exception &e) {
-                        Logger::log(e.what());
-                        auto &tmp = cache_.at(p);
-                        cache_[p] = {tmp->get(), tmp->width(), tmp->height(), true};
-                    }
-                    for (int i = 0; i < (2 * w) * (2 * h); i++) {
-                        for (int c = 0; c < 4; c++) {
-                            int byte = std::round(output[c * (2 * w) * (2 * h) + i] * 255);
-                            dest[4 * i + c] = std::max(0, std::min(255, byte));
+                }
+                catch (Ort::Exception &e) {
+                    Logger::log(e.what());
+                    // 線形補間で拡大したものをそのまま使い、再び依頼されないようにする
+                    {
+                        std::unique_lock<std::mutex> lock(mutex_);
+                        auto &s = slot(cache_, p);
+                        if (scale == scale_ && s.loaded && s.info) {
+                            s.info = ImageInfo{s.info->get(), s.info->width(), s.info->height(), true};
                         }
                     }
+                    glfwPostEmptyEvent();
+                    continue;
                 }
-                if (info->width() * scale_ / 100.0 != w) {
-                    int w_resize = std::round(info->width() * scale_ / 100.0);
-                    int h_resize = std::round(info->height() * scale_ / 100.0);
+                if (info->width() * scale / 100.0 != w) {
+                    int w_resize = std::round(info->width() * scale / 100.0);
+                    int h_resize = std::round(info->height() * scale / 100.0);
                     std::vector<unsigned char> resize;
                     resize.resize(w_resize * h_resize * 4);
                     stbir_resize_uint8_linear(dest.data(), w, h, 0, resize.data(), w_resize, h_resize, 0, STBIR_RGBA);
@@ -77,31 +97,120 @@ ImageCache::ImageCache(const std::filesystem::path &exe_dir, bool use_self_alpha
                     w = w_resize;
                     h = h_resize;
                 }
+                ImageInfo result{dest, w, h, true};
+                bool current;
                 {
                     std::unique_lock<std::mutex> lock(mutex_);
-                    if (scale == scale_) {
-                        cache_[p] = {dest, w, h, true};
+                    current = (scale == scale_);
+                    if (current) {
+                        slot(cache_, p) = {true, result};
                     }
                 }
+                // 次回の起動では超解像をやり直さない
+                if (current) {
+                    store_.save(digest, use_self_alpha_, scale, result);
+                }
                 Logger::log("upconverted!");
+                // 描画ループを起こして差し替えてもらう
+                glfwPostEmptyEvent();
             }
         });
     }
     catch (Ort::Exception &e) {
         Logger::log(e.what());
     }
-}
 #endif // USE_ONNX
+}
 
 ImageCache::~ImageCache() {
-    alive_ = false;
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        alive_ = false;
+        cond_.notify_one();
+        decode_cond_.notify_all();
+    }
     if (th_) {
+        th_->join();
+    }
+    for (auto &th : decoders_) {
+        th.join();
+    }
+}
+
+// 読み込みスレッドの本体
+// 元画像の読み込みと今の倍率への拡縮までを行う
+void ImageCache::decode() {
+    while (true) {
+        uint32_t id;
+        uint64_t epoch;
+        int scale;
+        bool loaded;
+        uint64_t digest = 0;
+        std::optional<ImageInfo> orig;
         {
             std::unique_lock<std::mutex> lock(mutex_);
-            queue_.push("");
-            cond_.notify_one();
+            decode_cond_.wait(lock, [&]() { return !decode_queue_.empty() || !alive_; });
+            if (!alive_) {
+                break;
+            }
+            id = decode_queue_.front();
+            decode_queue_.pop_front();
+            epoch = epoch_;
+            scale = scale_;
+            auto &o = slot(cache_orig_, id);
+            loaded = o.loaded;
+            if (loaded) {
+                orig = o.info;
+                digest = o.digest;
+            }
         }
-        th_->join();
+        if (!loaded) {
+            orig = load(ImagePath::get(id), use_self_alpha_, store_, digest);
+        }
+        std::optional<ImageInfo> info = orig;
+        bool upconvert = false;
+        if (orig && scale != 100) {
+            upconvert = (scale > 100 && th_);
+            // 前回の起動で超解像した結果があればそれを使う
+            std::optional<ImageInfo> stored;
+            if (upconvert) {
+                stored = store_.load(digest, use_self_alpha_, scale);
+            }
+            if (stored) {
+                info = std::move(stored);
+                upconvert = false;
+            }
+            else {
+                int w = std::round(orig->width() * scale / 100.0);
+                int h = std::round(orig->height() * scale / 100.0);
+                std::vector<unsigned char> resize;
+                resize.resize(w * h * 4);
+                stbir_resize_uint8_linear(orig->get().data(), orig->width(), orig->height(), 0, resize.data(), w, h, 0, STBIR_RGBA);
+                info = ImageInfo{resize, w, h, !upconvert};
+            }
+        }
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            // 読み込み中にキャッシュが消されていたら捨てる
+            if (epoch != epoch_) {
+                continue;
+            }
+            if (!loaded) {
+                auto &o = slot(cache_orig_, id);
+                o.loaded = true;
+                o.info = orig;
+                o.digest = digest;
+            }
+            if (scale == scale_) {
+                slot(cache_, id) = {true, info};
+                if (upconvert) {
+                    queue_.push(id);
+                    cond_.notify_one();
+                }
+            }
+        }
+        // 描画ループを起こして差し替えてもらう
+        glfwPostEmptyEvent();
     }
 }
 
@@ -111,42 +220,40 @@ void ImageCache::setScale(int scale) {
     cache_.clear();
 }
 
-const std::optional<ImageInfo> &ImageCache::getOriginal(const std::filesystem::path &path) {
-    Logger::log("scale => ", scale_);
-    if (cache_orig_.contains(path)) {
-        return cache_orig_.at(path);
+// 元画像を読み込んで透過色の処理などを行う
+// 同じ内容の画像を処理したことがあれば保存しておいた結果を使う
+// 複数のスレッドから呼ばれるのでメンバには触らない
+std::optional<ImageInfo> ImageCache::load(const std::filesystem::path &path, bool use_self_alpha, const ImageStore &store, uint64_t &digest) {
+    std::string image, pna_image;
+    if (!readFile(path, image)) {
+        return std::nullopt;
+    }
+    if (!use_self_alpha) {
+        auto pna_filename = path.parent_path() / path.stem();
+        pna_filename += ".pna";
+        readFile(pna_filename, pna_image);
+    }
+    digest = ImageStore::digest(image, pna_image);
+    if (auto info = store.load(digest, use_self_alpha, 100)) {
+        return info;
     }
     unsigned char *p;
     int w, h, _bpp;
-    p = stbi_load(path.string().c_str(), &w, &h, &_bpp, 4);
+    p = stbi_load_from_memory(reinterpret_cast<const stbi_uc *>(image.data()), image.size(), &w, &h, &_bpp, 4);
     if (p == nullptr) {
-        cache_orig_[path] = std::nullopt;
-        return cache_orig_.at(path);
+        return std::nullopt;
     }
     std::vector<unsigned char> data;
     data.resize(w * h * 4);
-    for (int i = 0; i < w * h; i++) {
-        // alpha: 0なら全て0にする
-        if (p[4 * i + 3] == 0) {
-            data[4 * i + 0] = 0;
-            data[4 * i + 1] = 0;
-            data[4 * i + 2] = 0;
-            data[4 * i + 3] = 0;
-        }
-        else {
-            data[4 * i + 0] = p[4 * i + 0];
-            data[4 * i + 1] = p[4 * i + 1];
-            data[4 * i + 2] = p[4 * i + 2];
-            data[4 * i + 3] = p[4 * i + 3];
-        }
-    }
+    // alpha: 0なら全て0にする
+    image_filter::clearTransparent(p, data.data(), w * h);
     stbi_image_free(p);
-    if (!use_self_alpha_) {
-        auto pna_filename = path.parent_path() / path.stem();
-        pna_filename += ".pna";
-        unsigned char *pna;
+    if (!use_self_alpha) {
+        unsigned char *pna = nullptr;
         int w_pna, h_pna, _bpp_pna;
-        pna = stbi_load(pna_filename.string().c_str(), &w_pna, &h_pna, &_bpp_pna, 4);
+        if (!pna_image.empty()) {
+            pna = stbi_load_from_memory(reinterpret_cast<const stbi_uc *>(pna_image.data()), pna_image.size(), &w_pna, &h_pna, &_bpp_pna, 4);
+        }
         if (pna != nullptr && w == w_pna && h == h_pna) {
             for (int i = 0; i < w * h; i++) {
                 int alpha = pna[4 * i];
@@ -154,17 +261,7 @@ const std::optional<ImageInfo> &ImageCache::getOriginal(const std::filesystem::p
             }
         }
         else {
-            int r = data[0 + 0];
-            int g = data[0 + 1];
-            int b = data[0 + 2];
-            for (int i = 0; i < w * h; i++) {
-                if (data[4 * i + 0] == r && data[4 * i + 1] == g && data[4 * i + 2] == b) {
-                    data[4 * i + 0] = 0;
-                    data[4 * i + 1] = 0;
-                    data[4 * i + 2] = 0;
-                    data[4 * i + 3] = 0;
-                }
-            }
+            image_filter::colorKey(data.data(), w * h);
         }
         if (pna != nullptr) {
             stbi_image_free(pna);
@@ -173,104 +270,51 @@ const std::optional<ImageInfo> &ImageCache::getOriginal(const std::filesystem::p
     // そのままだとalphaが0とそうでない部分の境界で
     // alpha-blendがうまくいかなくなるので
     // alpha>0なピクセルの値をalpha=0なピクセルに伝播させる
-    {
-        std::vector<unsigned char> blurred;
-        blurred.resize(data.size());
-        const int blur[3][3] = {
-            {1, 2, 1},
-            {2, 4, 2},
-            {1, 2, 1},
-        };
-        auto in = [](int x, int y, int w, int h) {
-            if (x < 0) {
-                return false;
-            }
-            if (y < 0) {
-                return false;
-            }
-            if (x >= w) {
-                return false;
-            }
-            if (y >= h) {
-                return false;
-            }
-            return true;
-        };
-        for (int y = 0; y < h; y++) {
-            for (int x = 0; x < w; x++) {
-                double n = 0.0;
-                int sum[4] = {};
-                for (int j = -1; j <= 1; j++) {
-                    for (int i = -1; i <= 1; i++) {
-                        if (in(x + i, y + j, w, h)) {
-                            int index = 4 * ((y + j) * w + (x + i));
-                            // alpha>0なピクセルを伝播させるため
-                            // alpha=0なら無視する
-                            if (data[index + 3] == 0) {
-                                continue;
-                            }
-                            auto factor = blur[1 + j][1 + i];
-                            n += factor;
-                            sum[0] += data[index + 0] * factor;
-                            sum[1] += data[index + 1] * factor;
-                            sum[2] += data[index + 2] * factor;
-                            sum[3] += data[index + 3] * factor;
-                        }
-                    }
-                }
-                int index = 4 * (y * w + x);
-                blurred[index + 0] = std::min(255.0, std::ceil(sum[0] / n));
-                blurred[index + 1] = std::min(255.0, std::ceil(sum[1] / n));
-                blurred[index + 2] = std::min(255.0, std::ceil(sum[2] / n));
-                blurred[index + 3] = std::min(255.0, std::ceil(sum[3] / n));
-            }
-        }
-        for (int i = 0; i < w * h; i++) {
-            // alpha以外を伝播
-            if (blurred[4 * i + 3] > 0 && data[4 * i + 3] == 0) {
-                data[4 * i + 0] = blurred[4 * i + 0];
-                data[4 * i + 1] = blurred[4 * i + 1];
-                data[4 * i + 2] = blurred[4 * i + 2];
-            }
-        }
-    }
-    cache_orig_[path] = {data, w, h, true};
-    return cache_orig_.at(path);
+    image_filter::bleed(data.data(), w, h);
+    ImageInfo info{data, w, h, true};
+    store.save(digest, use_self_alpha, 100, info);
+    return info;
 }
 
-const std::optional<ImageInfo> &ImageCache::get(const std::filesystem::path &path) {
-    {
-        std::unique_lock<std::mutex> lock(mutex_);
-        if (cache_.contains(path)) {
-            return cache_.at(path);
-        }
-    }
-    const auto &info = getOriginal(path);
-    if (info == std::nullopt || scale_ == 100) {
-        cache_[path] = info;
-        return cache_.at(path);
-    }
-    int w = std::round(info->width() * scale_ / 100.0);
-    int h = std::round(info->height() * scale_ / 100.0);
-    std::vector<unsigned char> resize;
-    resize.resize(w * h * 4);
-    stbir_resize_uint8_linear(info->get().data(), info->width(), info->height(), 0, resize.data(), w, h, 0, STBIR_RGBA);
-    if (scale_ <= 100 || !th_) {
-        cache_[path] = {resize, w, h, true};
+// 読み込みが終わっていなければ読み込みを依頼してnulloptを返す
+// 読み込みに失敗した場合と区別するにはready()を使う
+const std::optional<ImageInfo> &ImageCache::get(uint32_t id) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    auto &s = slot(cache_, id);
+    if (!s.loaded) {
+        request(s, id);
+        return none_;
     }
-    else {
-        cache_[path] = {resize, w, h, false};
-        {
-            std::unique_lock<std::mutex> lock(mutex_);
-            queue_.push(path);
-        }
-        cond_.notify_one();
+    return s.info;
+}
+
+bool ImageCache::ready(uint32_t id) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    return slot(cache_, id).loaded;
+}
+
+void ImageCache::request(uint32_t id) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    auto &s = slot(cache_, id);
+    if (!s.loaded) {
+        request(s, id);
     }
+}
 
-    return cache_.at(path);
+// mutex_を取った状態で呼ぶ
+void ImageCache::request(ImageSlot &s, uint32_t id) {
+    if (s.requested) {
+        return;
+    }
+    s.requested = true;
+    decode_queue_.push_back(id);
+    decode_cond_.notify_one();
 }
 
 void ImageCache::clearCache() {
+    std::unique_lock<std::mutex> lock(mutex_);
     cache_.clear();
     cache_orig_.clear();
+    decode_queue_.clear();
+    epoch_++;
 }
@@ -2,36 +2,28 @@
 #define IMAGE_CACHE_H_
 
 #include <condition_variable>
+#include <cstdint>
+#include <deque>
 #include <filesystem>
+#include <memory>
 #include <mutex>
-#if defined(USE_ONNX)
-#include <onnxruntime_cxx_api.h>
-#endif // USE_ONNX
 #include <optional>
 #include <queue>
-#include <unordered_map>
+#include <thread>
 #include <vector>
 
-class ImageInfo {
-    private:
-        std::vector<unsigned char> data_;
-        int width_, height_;
-        bool is_upconverted_;
-    public:
-        ImageInfo(const std::vector<unsigned char> &data, int width, int height, bool is_upconverted) : data_(data), width_(width), height_(height), is_upconverted_(is_upconverted) {}
-        ~ImageInfo() {}
-        const std::vector<unsigned char> &get() const {
-            return data_;
-        }
-        int width() const {
-            return width_;
-        }
-        int height() const {
-            return height_;
-        }
-        bool isUpconverted() const {
-            return is_upconverted_;
-        }
+#include "image_info.h"
+#include "image_store.h"
+#include "upscaler.h"
+
+// 読み込みに失敗した場合もinfoをnulloptにして覚えておく
+struct ImageSlot {
+    bool loaded = false;
+    std::optional<ImageInfo> info;
+    // 読み込みスレッドに依頼済み
+    bool requested = false;
+    // 元画像の内容のハッシュ(cache_orig_のみ)
+    uint64_t digest = 0;
 };
 
 class ImageCache {
@@ -42,26 +34,44 @@ class ImageCache {
         std::mutex mutex_;
         std::condition_variable cond_;
         std::unique_ptr<std::thread> th_;
-        std::queue<std::filesystem::path> queue_;
-        std::unordered_map<std::filesystem::path, std::optional<ImageInfo>> cache_orig_;
-        std::unordered_map<std::filesystem::path, std::optional<ImageInfo>> cache_;
+        std::queue<uint32_t> queue_;
+        // ImagePathのidで引く
+        // dequeなので伸ばしても返した参照は無効にならない
+        std::deque<ImageSlot> cache_orig_;
+        std::deque<ImageSlot> cache_;
+        // 読み込み待ちのid
+        std::deque<uint32_t> decode_queue_;
+        std::condition_variable decode_cond_;
+        std::vector<std::thread> decoders_;
+        // clearCacheする度に増やし、それ以前に始めた読み込みの結果は捨てる
+        uint64_t epoch_;
+        // 読み込み中に返す
+        const std::optional<ImageInfo> none_;
+
+        static ImageSlot &slot(std::deque<ImageSlot> &cache, uint32_t id) {
+            if (cache.size() <= id) {
+                cache.resize(id + 1);
+            }
+            return cache[id];
+        }
 #if defined(USE_ONNX)
-        Ort::Env env_;
-        Ort::Session session_;
+        std::unique_ptr<Upscaler> upscaler_;
 #endif // USE_ONNX
 
-        const std::optional<ImageInfo> &getOriginal(const std::filesystem::path &path);
+        // 前処理済みの画像の保存先
+        const ImageStore store_;
+
+        static std::optional<ImageInfo> load(const std::filesystem::path &path, bool use_self_alpha, const ImageStore &store, uint64_t &digest);
+        void decode();
+        void request(ImageSlot &s, uint32_t id);
 
     public:
-#if defined(USE_ONNX)
         ImageCache(const std::filesystem::path &exe_dir, bool use_self_alpha);
-#else
-        ImageCache(const std::filesystem::path &exe_dir, bool use_self_alpha)
-        : alive_(true), use_self_alpha_(use_self_alpha), scale_(100) {}
-#endif // USE_ONNX
         ~ImageCache();
         void setScale(int scale);
-        const std::optional<ImageInfo> &get(const std::filesystem::path &path);
+        const std::optional<ImageInfo> &get(uint32_t id);
+        bool ready(uint32_t id);
+        void request(uint32_t id);
         void clearCache();
 };
 
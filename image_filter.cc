@@ -0,0 +1,477 @@
+#include "image_filter.h"
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define IMAGE_FILTER_X86
+#include <immintrin.h>
+#endif // x86 && GNUC
+
+// ぼかしは1-2-1の重みを縦横に分けて整数で足し合わせる
+// 各画素を(r*m, g*m, b*m, m)(mはalpha>0なら1)にして
+// 横方向に足したものを3行分持っておき、縦方向に足してから割る
+// 重みの合計は高々12、色の合計は高々255*12なので16bitに収まる
+// 元はdoubleで割ってceilしていたが、商が整数でなければ
+// 最も近い整数まで1/12以上離れているので整数の切り上げ除算と一致する
+namespace {
+    using image_filter::Isa;
+
+    struct Kernels {
+        void (*clear)(const unsigned char *src, unsigned char *dest, size_t n);
+        void (*key)(unsigned char *data, size_t n, uint32_t key);
+        // Pは両端に1画素ずつ0を足した長さ
+        void (*premask)(const unsigned char *row, uint16_t *p, int w);
+        void (*horizontal)(const uint16_t *p, uint16_t *h, int w);
+        void (*finalize)(unsigned char *row, const uint16_t *h0, const uint16_t *h1, const uint16_t *h2, int w);
+        void (*toPlanar)(const unsigned char *src, float *const planes[4], size_t n);
+        void (*fromPlanar)(const float *const planes[4], unsigned char *dest, size_t n);
+    };
+
+    // 各命令セット版の端数もこれで処理する
+    namespace scalar {
+        void clear(const unsigned char *src, unsigned char *dest, size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                if (src[4 * i + 3] == 0) {
+                    std::memset(dest + 4 * i, 0, 4);
+                }
+                else {
+                    std::memcpy(dest + 4 * i, src + 4 * i, 4);
+                }
+            }
+        }
+
+        void key(unsigned char *data, size_t begin, size_t end, uint32_t key) {
+            for (size_t i = begin; i < end; i++) {
+                uint32_t rgb = data[4 * i + 0] | (data[4 * i + 1] << 8) | (data[4 * i + 2] << 16);
+                if (rgb == key) {
+                    std::memset(data + 4 * i, 0, 4);
+                }
+            }
+        }
+
+        void premask(const unsigned char *row, uint16_t *p, int begin, int end) {
+            for (int x = begin; x < end; x++) {
+                uint16_t m = (row[4 * x + 3] != 0);
+                for (int c = 0; c < 3; c++) {
+                    p[4 * (x + 1) + c] = row[4 * x + c] * m;
+                }
+                p[4 * (x + 1) + 3] = m;
+            }
+        }
+
+        void horizontal(const uint16_t *p, uint16_t *h, int begin, int end) {
+            for (int i = 4 * begin; i < 4 * end; i++) {
+                h[i] = p[i] + 2 * p[i + 4] + p[i + 8];
+            }
+        }
+
+        void finalize(unsigned char *row, const uint16_t *h0, const uint16_t *h1, const uint16_t *h2, int begin, int end) {
+            for (int x = begin; x < end; x++) {
+                if (row[4 * x + 3] != 0) {
+                    continue;
+                }
+                int i = 4 * x;
+                int n = h0[i + 3] + 2 * h1[i + 3] + h2[i + 3];
+                for (int c = 0; c < 3; c++) {
+                    int sum = h0[i + c] + 2 * h1[i + c] + h2[i + c];
+                    // 0/0.0がNaNになり、std::min(255.0, NaN)が255になっていたのに合わせる
+                    row[i + c] = (n == 0) ? 255 : (sum + n - 1) / n;
+                }
+            }
+        }
+
+        void toPlanar(const unsigned char *src, float *const planes[4], size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                for (int c = 0; c < 4; c++) {
+                    planes[c][i] = src[4 * i + c] / 255.0f;
+                }
+            }
+        }
+
+        void fromPlanar(const float *const planes[4], unsigned char *dest, size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                for (int c = 0; c < 4; c++) {
+                    // NaNも0にする
+                    float v = planes[c][i] * 255.0f;
+                    if (!(v > 0.0f)) {
+                        v = 0.0f;
+                    }
+                    if (v > 255.0f) {
+                        v = 255.0f;
+                    }
+                    dest[4 * i + c] = static_cast<unsigned char>(std::nearbyint(v));
+                }
+            }
+        }
+
+        const Kernels kernels = {
+            [](const unsigned char *src, unsigned char *dest, size_t n) {
+                clear(src, dest, 0, n);
+            },
+            [](unsigned char *data, size_t n, uint32_t k) {
+                key(data, 0, n, k);
+            },
+            [](const unsigned char *row, uint16_t *p, int w) {
+                premask(row, p, 0, w);
+            },
+            [](const uint16_t *p, uint16_t *h, int w) {
+                horizontal(p, h, 0, w);
+            },
+            [](unsigned char *row, const uint16_t *h0, const uint16_t *h1, const uint16_t *h2, int w) {
+                finalize(row, h0, h1, h2, 0, w);
+            },
+            [](const unsigned char *src, float *const planes[4], size_t n) {
+                toPlanar(src, planes, 0, n);
+            },
+            [](const float *const planes[4], unsigned char *dest, size_t n) {
+                fromPlanar(planes, dest, 0, n);
+            },
+        };
+    }
+
+#if defined(IMAGE_FILTER_X86)
+    namespace sse41 {
+        __attribute__((target("sse4.1")))
+        void clear(const unsigned char *src, unsigned char *dest, size_t n) {
+            const __m128i alpha = _mm_set1_epi32(0xff000000);
+            const __m128i zero = _mm_setzero_si128();
+            size_t i = 0;
+            for (; i + 4 <= n; i += 4) {
+                __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 4 * i));
+                __m128i t = _mm_cmpeq_epi32(_mm_and_si128(v, alpha), zero);
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(dest + 4 * i), _mm_andnot_si128(t, v));
+            }
+            scalar::clear(src, dest, i, n);
+        }
+
+        __attribute__((target("sse4.1")))
+        void key(unsigned char *data, size_t n, uint32_t k) {
+            const __m128i rgb = _mm_set1_epi32(0x00ffffff);
+            const __m128i kv = _mm_set1_epi32(k);
+            size_t i = 0;
+            for (; i + 4 <= n; i += 4) {
+                auto p = reinterpret_cast<__m128i *>(data + 4 * i);
+                __m128i v = _mm_loadu_si128(p);
+                __m128i t = _mm_cmpeq_epi32(_mm_and_si128(v, rgb), kv);
+                _mm_storeu_si128(p, _mm_andnot_si128(t, v));
+            }
+            scalar::key(data, i, n, k);
+        }
+
+        __attribute__((target("sse4.1")))
+        void premask(const unsigned char *row, uint16_t *p, int w) {
+            const __m128i zero = _mm_setzero_si128();
+            const __m128i one = _mm_set1_epi16(1);
+            int x = 0;
+            for (; x + 2 <= w; x += 2) {
+                __m128i v = _mm_cvtepu8_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(row + 4 * x)));
+                // 各画素のalphaを4つに広げる
+                __m128i a = _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, 0xff), 0xff);
+                __m128i t = _mm_cmpeq_epi16(a, zero);
+                __m128i m = _mm_blend_epi16(v, one, 0x88);
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(p + 4 * (x + 1)), _mm_andnot_si128(t, m));
+            }
+            scalar::premask(row, p, x, w);
+        }
+
+        __attribute__((target("sse4.1")))
+        void horizontal(const uint16_t *p, uint16_t *h, int w) {
+            int x = 0;
+            for (; x + 2 <= w; x += 2) {
+                __m128i l = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 4 * x));
+                __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 4 * x + 4));
+                __m128i r = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 4 * x + 8));
+                __m128i s = _mm_add_epi16(_mm_add_epi16(l, r), _mm_slli_epi16(c, 1));
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(h + 4 * x), s);
+            }
+            scalar::horizontal(p, h, x, w);
+        }
+
+        // 1画素分の(r, g, b, n)を各色について切り上げ除算する
+        // n=0なら255
+        __attribute__((target("sse4.1")))
+        inline __m128i divide(__m128i v) {
+            const __m128 zero = _mm_setzero_ps();
+            const __m128 max = _mm_set1_ps(255.0f);
+            __m128 f = _mm_cvtepi32_ps(v);
+            __m128 n = _mm_shuffle_ps(f, f, 0xff);
+            __m128 q = _mm_ceil_ps(_mm_div_ps(f, n));
+            q = _mm_blendv_ps(q, max, _mm_cmpeq_ps(n, zero));
+            return _mm_cvtps_epi32(q);
+        }
+
+        __attribute__((target("sse4.1")))
+        void finalize(unsigned char *row, const uint16_t *h0, const uint16_t *h1, const uint16_t *h2, int w) {
+            const __m128i alpha = _mm_set1_epi32(0xff000000);
+            const __m128i rgb = _mm_set1_epi32(0x00ffffff);
+            const __m128i zero = _mm_setzero_si128();
+            int x = 0;
+            for (; x + 2 <= w; x += 2) {
+                auto p = reinterpret_cast<__m128i *>(row + 4 * x);
+                __m128i orig = _mm_loadl_epi64(p);
+                __m128i t = _mm_cmpeq_epi32(_mm_and_si128(orig, alpha), zero);
+                // 上位64bitは0なので除く
+                t = _mm_unpacklo_epi64(t, zero);
+                if (_mm_testz_si128(t, t)) {
+                    continue;
+                }
+                int i = 4 * x;
+                __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(h0 + i));
+                __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(h1 + i));
+                __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i *>(h2 + i));
+                __m128i v = _mm_add_epi16(_mm_add_epi16(a, c), _mm_slli_epi16(b, 1));
+                __m128i lo = divide(_mm_cvtepu16_epi32(v));
+                __m128i hi = divide(_mm_cvtepu16_epi32(_mm_srli_si128(v, 8)));
+                __m128i res = _mm_packus_epi16(_mm_packus_epi32(lo, hi), zero);
+                res = _mm_blendv_epi8(orig, _mm_and_si128(res, rgb), t);
+                _mm_storel_epi64(p, res);
+            }
+            scalar::finalize(row, h0, h1, h2, x, w);
+        }
+
+        // 4画素のRGBAと、4画素ずつのR、G、B、Aを入れ替える
+        __attribute__((target("sse4.1")))
+        inline __m128i transpose(__m128i v) {
+            const __m128i order = _mm_setr_epi8(0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15);
+            return _mm_shuffle_epi8(v, order);
+        }
+
+        __attribute__((target("sse4.1")))
+        void toPlanar(const unsigned char *src, float *const planes[4], size_t n) {
+            const __m128 max = _mm_set1_ps(255.0f);
+            size_t i = 0;
+            for (; i + 4 <= n; i += 4) {
+                __m128i v = transpose(_mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 4 * i)));
+                for (int c = 0; c < 4; c++) {
+                    __m128 f = _mm_cvtepi32_ps(_mm_cvtepu8_epi32(v));
+                    _mm_storeu_ps(planes[c] + i, _mm_div_ps(f, max));
+                    v = _mm_srli_si128(v, 4);
+                }
+            }
+            scalar::toPlanar(src, planes, i, n);
+        }
+
+        __attribute__((target("sse4.1")))
+        void fromPlanar(const float *const planes[4], unsigned char *dest, size_t n) {
+            const __m128 zero = _mm_setzero_ps();
+            const __m128 max = _mm_set1_ps(255.0f);
+            size_t i = 0;
+            for (; i + 4 <= n; i += 4) {
+                __m128i c[4];
+                for (int k = 0; k < 4; k++) {
+                    // maxpsは片方がNaNなら2番目の引数を返す
+                    __m128 v = _mm_mul_ps(_mm_loadu_ps(planes[k] + i), max);
+                    v = _mm_min_ps(_mm_max_ps(v, zero), max);
+                    c[k] = _mm_cvtps_epi32(v);
+                }
+                __m128i rg = _mm_packs_epi32(c[0], c[1]);
+                __m128i ba = _mm_packs_epi32(c[2], c[3]);
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(dest + 4 * i), transpose(_mm_packus_epi16(rg, ba)));
+            }
+            scalar::fromPlanar(planes, dest, i, n);
+        }
+
+        const Kernels kernels = {clear, key, premask, horizontal, finalize, toPlanar, fromPlanar};
+    }
+
+    namespace avx2 {
+        __attribute__((target("avx2")))
+        void clear(const unsigned char *src, unsigned char *dest, size_t n) {
+            const __m256i alpha = _mm256_set1_epi32(0xff000000);
+            const __m256i zero = _mm256_setzero_si256();
+            size_t i = 0;
+            for (; i + 8 <= n; i += 8) {
+                __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + 4 * i));
+                __m256i t = _mm256_cmpeq_epi32(_mm256_and_si256(v, alpha), zero);
+                _mm256_storeu_si256(reinterpret_cast<__m256i *>(dest + 4 * i), _mm256_andnot_si256(t, v));
+            }
+            scalar::clear(src, dest, i, n);
+        }
+
+        __attribute__((target("avx2")))
+        void key(unsigned char *data, size_t n, uint32_t k) {
+            const __m256i rgb = _mm256_set1_epi32(0x00ffffff);
+            const __m256i kv = _mm256_set1_epi32(k);
+            size_t i = 0;
+            for (; i + 8 <= n; i += 8) {
+                auto p = reinterpret_cast<__m256i *>(data + 4 * i);
+                __m256i v = _mm256_loadu_si256(p);
+                __m256i t = _mm256_cmpeq_epi32(_mm256_and_si256(v, rgb), kv);
+                _mm256_storeu_si256(p, _mm256_andnot_si256(t, v));
+            }
+            scalar::key(data, i, n, k);
+        }
+
+        __attribute__((target("avx2")))
+        void premask(const unsigned char *row, uint16_t *p, int w) {
+            const __m256i zero = _mm256_setzero_si256();
+            const __m256i one = _mm256_set1_epi16(1);
+            int x = 0;
+            for (; x + 4 <= w; x += 4) {
+                __m256i v = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i *>(row + 4 * x)));
+                __m256i a = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(v, 0xff), 0xff);
+                __m256i t = _mm256_cmpeq_epi16(a, zero);
+                __m256i m = _mm256_blend_epi16(v, one, 0x88);
+                _mm256_storeu_si256(reinterpret_cast<__m256i *>(p + 4 * (x + 1)), _mm256_andnot_si256(t, m));
+            }
+            scalar::premask(row, p, x, w);
+        }
+
+        __attribute__((target("avx2")))
+        void horizontal(const uint16_t *p, uint16_t *h, int w) {
+            int x = 0;
+            for (; x + 4 <= w; x += 4) {
+                __m256i l = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + 4 * x));
+                __m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + 4 * x + 4));
+                __m256i r = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + 4 * x + 8));
+                __m256i s = _mm256_add_epi16(_mm256_add_epi16(l, r), _mm256_slli_epi16(c, 1));
+                _mm256_storeu_si256(reinterpret_cast<__m256i *>(h + 4 * x), s);
+            }
+            scalar::horizontal(p, h, x, w);
+        }
+
+        // 2画素分の(r, g, b, n)を各色について切り上げ除算する
+        __attribute__((target("avx2")))
+        inline __m256i divide(__m256i v) {
+            const __m256 zero = _mm256_setzero_ps();
+            const __m256 max = _mm256_set1_ps(255.0f);
+            __m256 f = _mm256_cvtepi32_ps(v);
+            __m256 n = _mm256_shuffle_ps(f, f, 0xff);
+            __m256 q = _mm256_round_ps(_mm256_div_ps(f, n), _MM_FROUND_TO_POS_INF | _MM_FROUND_NO_EXC);
+            q = _mm256_blendv_ps(q, max, _mm256_cmp_ps(n, zero, _CMP_EQ_OQ));
+            return _mm256_cvtps_epi32(q);
+        }
+
+        __attribute__((target("avx2")))
+        void finalize(unsigned char *row, const uint16_t *h0, const uint16_t *h1, const uint16_t *h2, int w) {
+            const __m128i alpha = _mm_set1_epi32(0xff000000);
+            const __m128i rgb = _mm_set1_epi32(0x00ffffff);
+            const __m128i zero = _mm_setzero_si128();
+            int x = 0;
+            for (; x + 4 <= w; x += 4) {
+                auto p = reinterpret_cast<__m128i *>(row + 4 * x);
+                __m128i orig = _mm_loadu_si128(p);
+                __m128i t = _mm_cmpeq_epi32(_mm_and_si128(orig, alpha), zero);
+                if (_mm_testz_si128(t, t)) {
+                    continue;
+                }
+                int i = 4 * x;
+                __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(h0 + i));
+                __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(h1 + i));
+                __m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(h2 + i));
+                __m256i v = _mm256_add_epi16(_mm256_add_epi16(a, c), _mm256_slli_epi16(b, 1));
+                __m256i lo = divide(_mm256_cvtepu16_epi32(_mm256_castsi256_si128(v)));
+                __m256i hi = divide(_mm256_cvtepu16_epi32(_mm256_extracti128_si256(v, 1)));
+                // packusは128bitごとに詰めるので画素の順に並べ直す
+                __m256i s = _mm256_permute4x64_epi64(_mm256_packus_epi32(lo, hi), 0xd8);
+                __m128i res = _mm_packus_epi16(_mm256_castsi256_si128(s), _mm256_extracti128_si256(s, 1));
+                res = _mm_blendv_epi8(orig, _mm_and_si128(res, rgb), t);
+                _mm_storeu_si128(p, res);
+            }
+            scalar::finalize(row, h0, h1, h2, x, w);
+        }
+
+        // 浮動小数への変換はメモリ転送が律速なのでSSE4.1版を使う
+        const Kernels kernels = {clear, key, premask, horizontal, finalize, sse41::toPlanar, sse41::fromPlanar};
+    }
+#endif // IMAGE_FILTER_X86
+
+    const Kernels &select(Isa isa) {
+        switch (isa) {
+#if defined(IMAGE_FILTER_X86)
+            case Isa::AVX2:
+                return avx2::kernels;
+            case Isa::SSE41:
+                return sse41::kernels;
+#endif // IMAGE_FILTER_X86
+            default:
+                return scalar::kernels;
+        }
+    }
+
+    Isa isa = image_filter::detect();
+    const Kernels *kernels = &select(isa);
+}
+
+namespace image_filter {
+    Isa detect() {
+#if defined(IMAGE_FILTER_X86)
+        if (__builtin_cpu_supports("avx2")) {
+            return Isa::AVX2;
+        }
+        if (__builtin_cpu_supports("sse4.1")) {
+            return Isa::SSE41;
+        }
+#endif // IMAGE_FILTER_X86
+        return Isa::Scalar;
+    }
+
+    Isa current() {
+        return isa;
+    }
+
+    bool use(Isa target) {
+        if (static_cast<int>(target) > static_cast<int>(detect())) {
+            return false;
+        }
+        isa = target;
+        kernels = &select(isa);
+        return true;
+    }
+
+    void clearTransparent(const unsigned char *src, unsigned char *dest, size_t n) {
+        kernels->clear(src, dest, n);
+    }
+
+    void colorKey(unsigned char *data, size_t n) {
+        if (n == 0) {
+            return;
+        }
+        uint32_t key = data[0] | (data[1] << 8) | (data[2] << 16);
+        kernels->key(data, n, key);
+    }
+
+    void toPlanar(const unsigned char *src, float *const planes[4], size_t n) {
+        kernels->toPlanar(src, planes, n);
+    }
+
+    void fromPlanar(const float *const planes[4], unsigned char *dest, size_t n) {
+        kernels->fromPlanar(planes, dest, n);
+    }
+
+    void bleed(unsigned char *data, int w, int h) {
+        if (w <= 0 || h <= 0) {
+            return;
+        }
+        size_t stride = 4 * static_cast<size_t>(w);
+        std::vector<uint16_t> p(stride + 8, 0);
+        // 範囲外の行は0として扱う
+        std::vector<uint16_t> zero(stride, 0);
+        std::vector<uint16_t> rows[3] = {
+            std::vector<uint16_t>(stride), std::vector<uint16_t>(stride), std::vector<uint16_t>(stride),
+        };
+        auto horizontal = [&](int y, uint16_t *out) {
+            kernels->premask(data + stride * y, p.data(), w);
+            kernels->horizontal(p.data(), out, w);
+        };
+        horizontal(0, rows[0].data());
+        const uint16_t *prev = zero.data();
+        const uint16_t *current = rows[0].data();
+        for (int y = 0; y < h; y++) {
+            // 書き換えるのはalpha=0の画素の色だけで、mを掛けると0になるので
+            // 次の行を求める前に書き換えてもよい
+            const uint16_t *next = zero.data();
+            if (y + 1 < h) {
+                uint16_t *r = rows[(y + 1) % 3].data();
+                horizontal(y + 1, r);
+                next = r;
+            }
+            kernels->finalize(data + stride * y, prev, current, next, w);
+            prev = current;
+            current = next;
+        }
+    }
+}
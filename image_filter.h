@@ -0,0 +1,35 @@
+#ifndef IMAGE_FILTER_H_
+#define IMAGE_FILTER_H_
+
+#include <cstddef>
+
+// 読み込んだ画像の前処理と変換
+// 使えればAVX2、SSE4.1を使い、どれを使っても結果は1ビットも変わらない
+namespace image_filter {
+    enum class Isa {
+        Scalar, SSE41, AVX2,
+    };
+
+    // 実行中のCPUで使える中で最も速いもの
+    Isa detect();
+    Isa current();
+    // ベンチマーク用。他のスレッドが使っている間は呼ばない
+    // CPUが対応していなければfalse
+    bool use(Isa isa);
+
+    // alpha=0の画素はRGBも0にしてコピーする
+    void clearTransparent(const unsigned char *src, unsigned char *dest, size_t n);
+    // 左上の画素と同じRGBの画素を透明にする
+    void colorKey(unsigned char *data, size_t n);
+    // alpha=0の画素の色を、周囲のalpha>0な画素の色を1-2-1で重み付けした平均にする
+    // 周囲にalpha>0な画素が無ければ白にする
+    void bleed(unsigned char *data, int w, int h);
+
+    // 超解像の入出力用
+    // RGBAの画素を[0, 1]の浮動小数の4つの面に分ける
+    void toPlanar(const unsigned char *src, float *const planes[4], size_t n);
+    // toPlanarの逆。[0, 255]に収めてから最も近い整数(偶数丸め)にする
+    void fromPlanar(const float *const planes[4], unsigned char *dest, size_t n);
+}
+
+#endif // IMAGE_FILTER_H_
@@ -0,0 +1,24 @@
+#include "image_info.h"
+
+// 読み込みスレッドで求めておき、描画スレッドでは走査しない
+void ImageInfo::scan() {
+    const unsigned char *p = data_.data();
+    for (int y = 0; y < height_; y++) {
+        int begin = -1;
+        for (int x = 0; x < width_; x++) {
+            int alpha = p[4 * (y * width_ + x) + 3];
+            if (alpha) {
+                if (begin == -1) {
+                    begin = x;
+                }
+            }
+            else if (begin != -1) {
+                region_.push_back({begin, y, x - begin, 1});
+                begin = -1;
+            }
+        }
+        if (begin != -1) {
+            region_.push_back({begin, y, width_ - begin, 1});
+        }
+    }
+}
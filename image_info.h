@@ -0,0 +1,40 @@
+#ifndef IMAGE_INFO_H_
+#define IMAGE_INFO_H_
+
+#include <vector>
+
+#include "misc.h"
+
+class ImageInfo {
+    private:
+        std::vector<unsigned char> data_;
+        int width_, height_;
+        bool is_upconverted_;
+        // alpha>0の画素が続く範囲(高さ1)
+        // 画像の左上を原点とする
+        std::vector<Rect> region_;
+        void scan();
+    public:
+        ImageInfo(const std::vector<unsigned char> &data, int width, int height, bool is_upconverted) : data_(data), width_(width), height_(height), is_upconverted_(is_upconverted) {
+            scan();
+        }
+        ImageInfo(std::vector<unsigned char> &&data, int width, int height, bool is_upconverted, std::vector<Rect> &&region) : data_(std::move(data)), width_(width), height_(height), is_upconverted_(is_upconverted), region_(std::move(region)) {}
+        ~ImageInfo() {}
+        const std::vector<unsigned char> &get() const {
+            return data_;
+        }
+        int width() const {
+            return width_;
+        }
+        int height() const {
+            return height_;
+        }
+        bool isUpconverted() const {
+            return is_upconverted_;
+        }
+        const std::vector<Rect> &region() const {
+            return region_;
+        }
+};
+
+#endif // IMAGE_INFO_H_
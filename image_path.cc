@@ -0,0 +1,5 @@
+#include "image_path.h"
+
+std::mutex ImagePath::mutex_;
+std::deque<std::filesystem::path> ImagePath::paths_;
+std::unordered_map<std::string, uint32_t> ImagePath::ids_;
@@ -0,0 +1,38 @@
+#ifndef IMAGE_PATH_H_
+#define IMAGE_PATH_H_
+
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+// 画像のパスに連番のidを振る
+// Element、ImageCache、TextureCacheはパスの代わりにidで画像を扱う
+// dequeに置くのでget()で返した参照は追加しても無効にならない
+class ImagePath {
+    private:
+        static std::mutex mutex_;
+        static std::deque<std::filesystem::path> paths_;
+        static std::unordered_map<std::string, uint32_t> ids_;
+    public:
+        static uint32_t intern(const std::filesystem::path &path) {
+            std::unique_lock<std::mutex> lock(mutex_);
+            auto [it, inserted] = ids_.try_emplace(path.string(), paths_.size());
+            if (inserted) {
+                paths_.push_back(path);
+            }
+            return it->second;
+        }
+        static const std::filesystem::path &get(uint32_t id) {
+            std::unique_lock<std::mutex> lock(mutex_);
+            return paths_.at(id);
+        }
+        static size_t size() {
+            std::unique_lock<std::mutex> lock(mutex_);
+            return paths_.size();
+        }
+};
+
+#endif // IMAGE_PATH_H_
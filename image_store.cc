@@ -0,0 +1,161 @@
+#include "image_store.h"
+
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <thread>
+
+#include "logger.h"
+#include "util.h"
+
+namespace {
+    const char magic[4] = {'A', 'Y', 'U', 'I'};
+    // 保存形式を変えたら上げる
+    const uint32_t format_version = 1;
+    // これより大きい画像は壊れたファイルとみなす
+    const uint32_t max_size = 16384;
+
+    // 整数は全てリトルエンディアンで書く
+    void put(std::string &out, uint32_t v) {
+        for (int i = 0; i < 4; i++) {
+            out.push_back(static_cast<char>((v >> (i * 8)) & 0xff));
+        }
+    }
+
+    uint32_t take(const std::string &in, size_t &pos) {
+        uint32_t v = 0;
+        for (int i = 0; i < 4; i++) {
+            v |= static_cast<uint32_t>(static_cast<unsigned char>(in[pos + i])) << (i * 8);
+        }
+        pos += 4;
+        return v;
+    }
+}
+
+ImageStore::ImageStore() {
+    auto dir = util::cacheDir();
+    if (dir.empty()) {
+        return;
+    }
+    dir /= "images";
+    std::error_code ec;
+    std::filesystem::create_directories(dir, ec);
+    if (ec) {
+        return;
+    }
+    dir_ = dir;
+}
+
+uint64_t ImageStore::digest(const std::string &image, const std::string &pna) {
+    // .pnaが無い場合と空の.pnaを区別するために長さも混ぜる
+    uint64_t size = pna.size();
+    uint64_t hash = util::fnv1a(image.data(), image.size());
+    hash = util::fnv1a(&size, sizeof(size), hash);
+    return util::fnv1a(pna.data(), pna.size(), hash);
+}
+
+std::filesystem::path ImageStore::path(uint64_t digest, bool use_self_alpha, int scale) const {
+    char name[40];
+    snprintf(name, sizeof(name), "%016llx-%d-%d.rgba", static_cast<unsigned long long>(digest), use_self_alpha ? 1 : 0, scale);
+    return dir_ / name;
+}
+
+// 見つからないか壊れていればnullopt
+std::optional<ImageInfo> ImageStore::load(uint64_t digest, bool use_self_alpha, int scale) const {
+    if (dir_.empty()) {
+        return std::nullopt;
+    }
+    auto p = path(digest, use_self_alpha, scale);
+    std::ifstream ifs(p, std::ios::binary | std::ios::ate);
+    if (!ifs) {
+        return std::nullopt;
+    }
+    std::string data(static_cast<size_t>(ifs.tellg()), '\0');
+    ifs.seekg(0);
+    if (!ifs.read(data.data(), data.size())) {
+        return std::nullopt;
+    }
+    // magic、version、digest(2)、use_self_alpha、scale、upconverted、幅、高さ、範囲の数
+    const size_t header = sizeof(magic) + 4 * 10;
+    if (data.size() < header || data.compare(0, sizeof(magic), magic, sizeof(magic)) != 0) {
+        return std::nullopt;
+    }
+    size_t pos = sizeof(magic);
+    if (take(data, pos) != format_version) {
+        return std::nullopt;
+    }
+    uint64_t d = take(data, pos);
+    d |= static_cast<uint64_t>(take(data, pos)) << 32;
+    bool self_alpha = take(data, pos);
+    int s = take(data, pos);
+    bool upconverted = take(data, pos);
+    uint32_t w = take(data, pos);
+    uint32_t h = take(data, pos);
+    uint32_t n = take(data, pos);
+    if (d != digest || self_alpha != use_self_alpha || s != scale) {
+        return std::nullopt;
+    }
+    if (w > max_size || h > max_size || n > (data.size() - pos) / 12) {
+        Logger::log("ImageStore: broken cache ", p);
+        return std::nullopt;
+    }
+    std::vector<Rect> region;
+    region.reserve(n);
+    for (uint32_t i = 0; i < n; i++) {
+        int x = take(data, pos);
+        int y = take(data, pos);
+        int width = take(data, pos);
+        region.push_back({x, y, width, 1});
+    }
+    if (data.size() - pos != static_cast<size_t>(w) * h * 4) {
+        Logger::log("ImageStore: broken cache ", p);
+        return std::nullopt;
+    }
+    std::vector<unsigned char> pixels(data.begin() + pos, data.end());
+    return ImageInfo{std::move(pixels), static_cast<int>(w), static_cast<int>(h), upconverted, std::move(region)};
+}
+
+void ImageStore::save(uint64_t digest, bool use_self_alpha, int scale, const ImageInfo &info) const {
+    if (dir_.empty()) {
+        return;
+    }
+    auto &region = info.region();
+    auto &pixels = info.get();
+    std::string data;
+    data.reserve(sizeof(magic) + 4 * 10 + region.size() * 12 + pixels.size());
+    data.append(magic, sizeof(magic));
+    put(data, format_version);
+    put(data, static_cast<uint32_t>(digest));
+    put(data, static_cast<uint32_t>(digest >> 32));
+    put(data, use_self_alpha);
+    put(data, scale);
+    put(data, info.isUpconverted());
+    put(data, info.width());
+    put(data, info.height());
+    put(data, region.size());
+    for (auto &r : region) {
+        put(data, r.x);
+        put(data, r.y);
+        put(data, r.width);
+    }
+    data.append(reinterpret_cast<const char *>(pixels.data()), pixels.size());
+    // 書き込み途中のファイルを読まないように別名で書いてから置き換える
+    // 同じ内容の画像を別のスレッドが書いていることがあるので名前を分ける
+    auto p = path(digest, use_self_alpha, scale);
+    auto tmp = p;
+    tmp += "." + std::to_string(std::hash<std::thread::id>{}(std::this_thread::get_id())) + ".tmp";
+    {
+        std::ofstream ofs(tmp, std::ios::binary | std::ios::trunc);
+        if (!ofs.write(data.c_str(), data.size())) {
+            ofs.close();
+            std::error_code ec;
+            std::filesystem::remove(tmp, ec);
+            return;
+        }
+    }
+    std::error_code ec;
+    std::filesystem::rename(tmp, p, ec);
+    if (ec) {
+        std::filesystem::remove(tmp, ec);
+    }
+}
@@ -0,0 +1,27 @@
+#ifndef IMAGE_STORE_H_
+#define IMAGE_STORE_H_
+
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <string>
+
+#include "image_info.h"
+
+// 透過色の処理などを済ませた画像をそのままの形でファイルに保存しておき
+// 次回以降はPNGの展開や超解像を省く
+// 元画像(と.pna)の内容のハッシュ、use_self_alpha、倍率で引く
+// 複数の読み込みスレッドから使うので状態は持たない
+class ImageStore {
+    private:
+        std::filesystem::path dir_;
+        std::filesystem::path path(uint64_t digest, bool use_self_alpha, int scale) const;
+    public:
+        ImageStore();
+        ~ImageStore() {}
+        static uint64_t digest(const std::string &image, const std::string &pna);
+        std::optional<ImageInfo> load(uint64_t digest, bool use_self_alpha, int scale) const;
+        void save(uint64_t digest, bool use_self_alpha, int scale, const ImageInfo &info) const;
+};
+
+#endif // IMAGE_STORE_H_
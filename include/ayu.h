@@ -2,7 +2,9 @@
 #define AYU_H_
 
 #include "base/request.h"
+#include "base/request_view.h"
 #include "base/response.h"
+#include "base/response_view.h"
 
 namespace ayu {
     const char protocol_name[] = "AYU";
@@ -13,6 +15,8 @@ namespace ayu {
     const char response_arg[] = "Value";
     typedef base::Request<protocol_name, protocol_version, request_value, request_arg> Request;
     typedef base::Response<protocol_name, protocol_version, response_value, response_arg> Response;
+    typedef base::RequestView<protocol_name, protocol_version, request_value, request_arg> RequestView;
+    typedef base::ResponseView<protocol_name, protocol_version, response_value, response_arg> ResponseView;
 }
 
 #endif // AYU_H_
@@ -1,12 +1,12 @@
 #ifndef SSTP_HEADER_H_
 #define SSTP_HEADER_H_
 
-#include <algorithm>
-#include <sstream>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 
 #include "base/optional.h"
+#include "base/protocol.h"
 
 namespace base {
 
@@ -16,26 +16,17 @@ class Header {
 
         ~Header() {}
 
-        static Header parse(std::string str) {
-            auto result = std::remove_if(str.begin(), str.end(),
-                    [](int ch) {return ch == '\x0d';}
-            );
-            str.erase(result, str.end());
-            std::istringstream iss(str);
-            return parse(iss);
-        }
-
-        static Header parse(std::istringstream& iss) {
+        // 空行までを読み、strは空行の次を指すようにする
+        static Header parse(std::string_view &str) {
             Header tmp;
-            std::string header;
-            while (std::getline(iss, header, '\x0a') && !header.empty()) {
-                decltype(header)::size_type pos    = header.find(':');
-                if (pos == decltype(header)::npos) {
+            std::string_view line;
+            while (nextLine(str, line) && !line.empty()) {
+                auto pos = line.find(':');
+                if (pos == std::string_view::npos) {
                     continue;
                 }
-                std::string key = header.substr(0, pos);
-                std::string value = header.substr(pos + 2);
-                tmp[key] = value;
+                auto value = (line.size() > pos + 2) ? (line.substr(pos + 2)) : (std::string_view());
+                tmp[std::string(line.substr(0, pos))] = std::string(value);
             }
             return tmp;
         }
@@ -45,22 +36,44 @@ class Header {
         }
 
         inline optional& operator[](const std::string& key) { return map_[key]; }
-        operator std::string() const {
-            std::ostringstream oss;
-            auto h = map_;
+        // write()で書き込まれるバイト数
+        size_t size() const {
+            size_t n = 0;
+            for (auto& [k, v] : map_) {
+                if (v) {
+                    n += k.size() + 2 + v.value().size() + 2;
+                }
+            }
+            return n;
+        }
+        // outの末尾に書き足す
+        void write(std::string &out) const {
             // Charsetは他のヘッダより優先する
-            if (h["Charset"]) {
-                oss << "Charset: " << h["Charset"].value() << "\x0d\x0a";
+            auto charset = map_.find("Charset");
+            if (charset != map_.end() && charset->second) {
+                append(out, charset->first, charset->second.value());
             }
-            for (auto& [k, v] : h) {
+            for (auto& [k, v] : map_) {
                 if (k != "Charset" && v) {
-                    oss << k << ": " << v.value() << "\x0d\x0a";
+                    append(out, k, v.value());
                 }
             }
-            return oss.str();
+        }
+        operator std::string() const {
+            std::string s;
+            s.reserve(size());
+            write(s);
+            return s;
         }
     private:
         std::unordered_map<std::string, optional> map_;
+
+        static void append(std::string &out, const std::string &key, const std::string &value) {
+            out.append(key);
+            out.append(": ");
+            out.append(value);
+            out.append("\x0d\x0a");
+        }
 };
 
 }
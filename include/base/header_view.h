@@ -0,0 +1,69 @@
+#ifndef SSTP_HEADER_VIEW_H_
+#define SSTP_HEADER_VIEW_H_
+
+#include <charconv>
+#include <optional>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "base/protocol.h"
+
+namespace base {
+
+// 受信バッファを指したままのヘッダ
+// 数十個程度なので線形探索の方が速い
+class HeaderView {
+    public:
+        HeaderView() {}
+
+        ~HeaderView() {}
+
+        // 空行までを読み、strは空行の次を指すようにする
+        void parse(std::string_view &str) {
+            std::string_view line;
+            while (nextLine(str, line) && !line.empty()) {
+                auto pos = line.find(':');
+                if (pos == std::string_view::npos) {
+                    continue;
+                }
+                auto value = (line.size() > pos + 2) ? (line.substr(pos + 2)) : (std::string_view());
+                map_.emplace_back(line.substr(0, pos), value);
+            }
+        }
+
+        void clear() {
+            map_.clear();
+        }
+
+        std::optional<std::string_view> operator[](std::string_view key) const {
+            // 同じキーは後のものを優先する
+            for (auto it = map_.rbegin(); it != map_.rend(); it++) {
+                if (it->first == key) {
+                    return it->second;
+                }
+            }
+            return std::nullopt;
+        }
+
+        // prefix + indexのキー(Argument0など)を探す
+        std::optional<std::string_view> get(std::string_view prefix, size_t index) const {
+            char buffer[24];
+            auto [end, _] = std::to_chars(buffer, buffer + sizeof(buffer), index);
+            std::string_view n(buffer, end - buffer);
+            for (auto it = map_.rbegin(); it != map_.rend(); it++) {
+                auto &k = it->first;
+                if (k.size() == prefix.size() + n.size() && k.starts_with(prefix) && k.ends_with(n)) {
+                    return it->second;
+                }
+            }
+            return std::nullopt;
+        }
+
+    private:
+        std::vector<std::pair<std::string_view, std::string_view>> map_;
+};
+
+}
+
+#endif // SSTP_HEADER_VIEW_H_
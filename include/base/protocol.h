@@ -0,0 +1,67 @@
+#ifndef SSTP_PROTOCOL_H_
+#define SSTP_PROTOCOL_H_
+
+#include <charconv>
+#include <string>
+#include <string_view>
+
+namespace base {
+
+    // 改行(CRLFまたはLF)までを1行として切り出す
+    constexpr bool nextLine(std::string_view &str, std::string_view &line) {
+        if (str.empty()) {
+            return false;
+        }
+        auto pos = str.find('\x0a');
+        if (pos == std::string_view::npos) {
+            line = str;
+            str = {};
+        }
+        else {
+            line = str.substr(0, pos);
+            str = str.substr(pos + 1);
+        }
+        if (line.ends_with('\x0d')) {
+            line.remove_suffix(1);
+        }
+        return true;
+    }
+
+    // name/\d+\.\d+
+    constexpr bool matchProtocol(std::string_view protocol, std::string_view name) {
+        if (!protocol.starts_with(name) || protocol.size() <= name.size() || protocol[name.size()] != '/') {
+            return false;
+        }
+        auto version = protocol.substr(name.size() + 1);
+        auto dot = version.find('.');
+        if (dot == std::string_view::npos || dot == 0 || dot + 1 == version.size()) {
+            return false;
+        }
+        for (std::string_view::size_type i = 0; i < version.size(); i++) {
+            if (i != dot && !(version[i] >= '0' && version[i] <= '9')) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Argument0などのキーを作る
+    inline std::string indexedKey(std::string_view prefix, size_t index) {
+        char buffer[24];
+        auto [end, _] = std::to_chars(buffer, buffer + sizeof(buffer), index);
+        std::string key;
+        key.reserve(prefix.size() + (end - buffer));
+        key.append(prefix);
+        key.append(buffer, end - buffer);
+        return key;
+    }
+
+    static_assert(matchProtocol("SSTP/1.4", "SSTP"));
+    static_assert(matchProtocol("AYU/0.9", "AYU"));
+    static_assert(!matchProtocol("SSTP/1.", "SSTP"));
+    static_assert(!matchProtocol("SSTP/a.4", "SSTP"));
+    static_assert(!matchProtocol("SSTPX/1.4", "SSTP"));
+
+}
+
+#endif // SSTP_PROTOCOL_H_
@@ -1,11 +1,11 @@
 #ifndef SSTP_REQUEST_H_
 #define SSTP_REQUEST_H_
 
-#include <regex>
-#include <sstream>
 #include <string>
+#include <string_view>
 
 #include "base/header.h"
+#include "base/protocol.h"
 
 namespace base {
 
@@ -14,33 +14,23 @@ namespace base {
             public:
                 Request(std::string command) : command_(command), protocol_(std::string(protocol_name) + "/" + protocol_version), header_() {}
                 ~Request() {}
-                static Request parse(std::string str) {
-                    auto result = std::remove_if(str.begin(), str.end(),
-                            [](int ch) {return ch == '\x0d';}
-                    );
-                    str.erase(result, str.end());
-                    std::istringstream iss(str);
-                    return parse(iss);
-                }
-                static Request parse(std::istringstream& iss) {
+                static Request parse(std::string_view str) {
                     Request ret;
-                    std::string line;
-                    getline(iss, line, '\x0a');
-                    decltype(line)::size_type pos    = line.rfind(' ');
-                    if (pos == decltype(line)::npos) {
+                    std::string_view line;
+                    if (!nextLine(str, line)) {
+                        return ret;
+                    }
+                    auto pos = line.rfind(' ');
+                    if (pos == std::string_view::npos) {
                         return ret;
                     }
-                    // assert protocol name
-                    // line.substr(pos + 1)
-                    std::string protocol = line.substr(pos + 1);
-                    std::ostringstream pattern;
-                    pattern << protocol_name << R"(/\d+\.\d+)";
-                    if (!regex_match(protocol, std::regex(pattern.str()))) {
+                    auto protocol = line.substr(pos + 1);
+                    if (!matchProtocol(protocol, protocol_name)) {
                         return ret;
                     }
                     ret.command_    = line.substr(0, pos);
                     ret.protocol_   = protocol;
-                    ret.header_     = Header::parse(iss);
+                    ret.header_     = Header::parse(str);
                     return ret;
                 }
                 std::string getCommand() { return command_; }
@@ -52,16 +42,27 @@ namespace base {
                     return header_[value];
                 }
                 optional& operator()(size_t index) {
-                    std::ostringstream oss;
-                    oss << arg << index;
-                    return header_[oss.str()];
+                    return header_[indexedKey(arg, index)];
+                }
+                // write()で書き込まれるバイト数
+                size_t size() const {
+                    return command_.size() + 1 + protocol_.size() + 2 + header_.size() + 2;
+                }
+                // outの末尾に書き足す
+                // 使い回すバッファを渡せば再確保されない
+                void write(std::string &out) const {
+                    out.reserve(out.size() + size());
+                    out.append(command_);
+                    out.append(" ");
+                    out.append(protocol_);
+                    out.append("\x0d\x0a");
+                    header_.write(out);
+                    out.append("\x0d\x0a");
                 }
                 operator std::string() const {
-                    std::ostringstream oss;
-                    oss << command_ << " " << protocol_ << "\x0d\x0a";
-                    oss << static_cast<std::string>(header_);
-                    oss << "\x0d\x0a";
-                    return oss.str();
+                    std::string s;
+                    write(s);
+                    return s;
                 }
 
             private:
@@ -0,0 +1,66 @@
+#ifndef SSTP_REQUEST_VIEW_H_
+#define SSTP_REQUEST_VIEW_H_
+
+#include <optional>
+#include <string_view>
+
+#include "base/header_view.h"
+#include "base/protocol.h"
+
+namespace base {
+
+    // 受信バッファを指したままリクエストを読む
+    // 同じインスタンスを使い回せばヘッダの領域も再確保されない
+    template<const char *protocol_name, const char *protocol_version, const char *value, const char *arg>
+        class RequestView {
+            public:
+                RequestView() : valid_(false) {}
+                ~RequestView() {}
+                bool parse(std::string_view str) {
+                    valid_ = false;
+                    command_ = {};
+                    protocol_ = {};
+                    header_.clear();
+                    std::string_view line;
+                    if (!nextLine(str, line)) {
+                        return false;
+                    }
+                    auto pos = line.rfind(' ');
+                    if (pos == std::string_view::npos) {
+                        return false;
+                    }
+                    auto protocol = line.substr(pos + 1);
+                    if (!matchProtocol(protocol, protocol_name)) {
+                        return false;
+                    }
+                    command_ = line.substr(0, pos);
+                    protocol_ = protocol;
+                    header_.parse(str);
+                    valid_ = true;
+                    return true;
+                }
+                explicit operator bool() const {
+                    return valid_;
+                }
+                std::string_view getCommand() const { return command_; }
+                std::string_view getProtocol() const { return protocol_; }
+                std::optional<std::string_view> operator[](std::string_view key) const {
+                    return header_[key];
+                }
+                std::optional<std::string_view> operator()() const {
+                    return header_[value];
+                }
+                std::optional<std::string_view> operator()(size_t index) const {
+                    return header_.get(arg, index);
+                }
+
+            private:
+                std::string_view command_;
+                std::string_view protocol_;
+                HeaderView header_;
+                bool valid_;
+        };
+
+}
+
+#endif // SSTP_REQUEST_VIEW_H_
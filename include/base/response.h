@@ -1,11 +1,12 @@
 #ifndef SSTP_RESPONSE_H_
 #define SSTP_RESPONSE_H_
 
-#include <regex>
-#include <sstream>
+#include <charconv>
 #include <string>
+#include <string_view>
 
 #include "base/header.h"
+#include "base/protocol.h"
 
 namespace base {
 
@@ -14,40 +15,32 @@ namespace base {
             public:
                 Response(int code, std::string status) : code_(code), status_(status), protocol_(std::string(protocol_name) + "/" + protocol_version), header_() {}
                 ~Response() {}
-                static Response parse(std::string str) {
-                    auto result = std::remove_if(str.begin(), str.end(),
-                            [](int ch) {return ch == '\x0d';}
-                    );
-                    str.erase(result, str.end());
-                    std::istringstream iss(str);
-                    return parse(iss);
-                }
-                static Response parse(std::istringstream& iss) {
+                static Response parse(std::string_view str) {
                     Response ret;
-                    std::string line;
-                    getline(iss, line, '\x0a');
-                    decltype(line)::size_type pos    = line.find(' ');
-                    if (pos == decltype(line)::npos) {
+                    std::string_view line;
+                    if (!nextLine(str, line)) {
+                        return ret;
+                    }
+                    auto pos = line.find(' ');
+                    if (pos == std::string_view::npos) {
                         return ret;
                     }
-                    // assert protocol name
-                    // line.substr(0, pos);
-                    std::string protocol = line.substr(0, pos);
-                    std::ostringstream pattern;
-                    pattern << protocol_name << R"(/\d+\.\d+)";
-                    if (!regex_match(protocol, std::regex(pattern.str()))) {
+                    auto protocol = line.substr(0, pos);
+                    if (!matchProtocol(protocol, protocol_name)) {
                         return ret;
                     }
                     line    = line.substr(pos + 1);
                     pos    = line.find(' ');
-                    if (pos == decltype(line)::npos) {
+                    if (pos == std::string_view::npos) {
                         return ret;
                     }
-                    ret.code_ = std::atoi(line.substr(0, pos).c_str());
+                    std::from_chars(line.data(), line.data() + pos, ret.code_);
                     ret.status_ = line.substr(pos + 1);
                     ret.protocol_   = protocol;
-                    ret.header_ = Header::parse(iss);
-                    std::getline(iss, ret.content_, '\x0a');
+                    ret.header_ = Header::parse(str);
+                    if (nextLine(str, line)) {
+                        ret.content_ = line;
+                    }
                     return ret;
                 }
                 int getStatusCode() { return code_; }
@@ -60,23 +53,45 @@ namespace base {
                     return header_[value];
                 }
                 optional& operator()(size_t index) {
-                    std::ostringstream oss;
-                    oss << arg << index;
-                    return header_[oss.str()];
+                    return header_[indexedKey(arg, index)];
                 }
                 std::string getContent() const {
                     return content_;
                 }
-                operator std::string() const {
-                    std::ostringstream oss;
-                    oss << protocol_ << " " << code_ << " " << status_ << "\x0d\x0a";
-                    oss << static_cast<std::string>(header_);
-                    oss << "\x0d\x0a";
+                // write()で書き込まれるバイト数
+                size_t size() const {
+                    char code[16];
+                    auto [end, _] = std::to_chars(code, code + sizeof(code), code_);
+                    size_t n = protocol_.size() + 1 + (end - code) + 1 + status_.size() + 2 + header_.size() + 2;
                     if (!content_.empty()) {
-                        oss << content_ << "\x0d\x0a";
-                        oss << "\x0d\x0a";
+                        n += content_.size() + 2 + 2;
                     }
-                    return oss.str();
+                    return n;
+                }
+                // outの末尾に書き足す
+                // 使い回すバッファを渡せば再確保されない
+                void write(std::string &out) const {
+                    out.reserve(out.size() + size());
+                    char code[16];
+                    auto [end, _] = std::to_chars(code, code + sizeof(code), code_);
+                    out.append(protocol_);
+                    out.append(" ");
+                    out.append(code, end - code);
+                    out.append(" ");
+                    out.append(status_);
+                    out.append("\x0d\x0a");
+                    header_.write(out);
+                    out.append("\x0d\x0a");
+                    if (!content_.empty()) {
+                        out.append(content_);
+                        out.append("\x0d\x0a");
+                        out.append("\x0d\x0a");
+                    }
+                }
+                operator std::string() const {
+                    std::string s;
+                    write(s);
+                    return s;
                 }
             private:
                 int code_;
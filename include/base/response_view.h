@@ -0,0 +1,84 @@
+#ifndef SSTP_RESPONSE_VIEW_H_
+#define SSTP_RESPONSE_VIEW_H_
+
+#include <charconv>
+#include <optional>
+#include <string_view>
+
+#include "base/header_view.h"
+#include "base/protocol.h"
+
+namespace base {
+
+    // 受信バッファを指したままレスポンスを読む
+    template<const char *protocol_name, const char *protocol_version, const char *value, const char *arg>
+        class ResponseView {
+            public:
+                ResponseView() : code_(0), valid_(false) {}
+                explicit ResponseView(std::string_view str) : ResponseView() {
+                    parse(str);
+                }
+                ~ResponseView() {}
+                bool parse(std::string_view str) {
+                    valid_ = false;
+                    code_ = 0;
+                    status_ = {};
+                    protocol_ = {};
+                    content_ = {};
+                    header_.clear();
+                    std::string_view line;
+                    if (!nextLine(str, line)) {
+                        return false;
+                    }
+                    auto pos = line.find(' ');
+                    if (pos == std::string_view::npos) {
+                        return false;
+                    }
+                    auto protocol = line.substr(0, pos);
+                    if (!matchProtocol(protocol, protocol_name)) {
+                        return false;
+                    }
+                    line = line.substr(pos + 1);
+                    pos = line.find(' ');
+                    if (pos == std::string_view::npos) {
+                        return false;
+                    }
+                    std::from_chars(line.data(), line.data() + pos, code_);
+                    status_ = line.substr(pos + 1);
+                    protocol_ = protocol;
+                    header_.parse(str);
+                    if (nextLine(str, line)) {
+                        content_ = line;
+                    }
+                    valid_ = true;
+                    return true;
+                }
+                explicit operator bool() const {
+                    return valid_;
+                }
+                int getStatusCode() const { return code_; }
+                std::string_view getStatus() const { return status_; }
+                std::string_view getProtocol() const { return protocol_; }
+                std::string_view getContent() const { return content_; }
+                std::optional<std::string_view> operator[](std::string_view key) const {
+                    return header_[key];
+                }
+                std::optional<std::string_view> operator()() const {
+                    return header_[value];
+                }
+                std::optional<std::string_view> operator()(size_t index) const {
+                    return header_.get(arg, index);
+                }
+
+            private:
+                int code_;
+                std::string_view status_;
+                std::string_view protocol_;
+                std::string_view content_;
+                HeaderView header_;
+                bool valid_;
+        };
+
+}
+
+#endif // SSTP_RESPONSE_VIEW_H_
@@ -2,7 +2,9 @@
 #define SSTP_H_
 
 #include "base/request.h"
+#include "base/request_view.h"
 #include "base/response.h"
+#include "base/response_view.h"
 
 namespace sstp {
     const char protocol_name[] = "SSTP";
@@ -13,6 +15,8 @@ namespace sstp {
     const char response_arg[] = "unused";
     typedef base::Request<protocol_name, protocol_version, request_value, request_arg> Request;
     typedef base::Response<protocol_name, protocol_version, response_value, response_arg> Response;
+    typedef base::RequestView<protocol_name, protocol_version, request_value, request_arg> RequestView;
+    typedef base::ResponseView<protocol_name, protocol_version, response_value, response_arg> ResponseView;
 }
 
 #endif // SSTP_H_
@@ -1,6 +1,8 @@
 #ifndef MISC_H_
 #define MISC_H_
 
+#include <algorithm>
+#include <string>
 #include <vector>
 
 enum class BindFlag {
@@ -59,6 +61,26 @@ struct Rect {
         const Rect &lhs = *this;
         return lhs.x == rhs.x && lhs.y == rhs.y && lhs.width == rhs.width && lhs.height == rhs.height;
     }
+    bool empty() const {
+        return width <= 0 || height <= 0;
+    }
+    // 両方を含む最小の矩形
+    Rect unite(const Rect &rhs) const {
+        if (rhs.empty()) {
+            return *this;
+        }
+        if (empty()) {
+            return rhs;
+        }
+        int left = std::min(x, rhs.x), top = std::min(y, rhs.y);
+        int right = std::max(x + width, rhs.x + rhs.width), bottom = std::max(y + height, rhs.y + rhs.height);
+        return {left, top, right - left, bottom - top};
+    }
+};
+
+// テクスチャ座標での矩形(0.0-1.0)
+struct UVRect {
+    float x, y, width, height;
 };
 
 struct Request {
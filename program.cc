@@ -1,5 +1,6 @@
 #include "program.h"
 
+#include <cstddef>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
@@ -9,11 +10,12 @@ namespace {
     const char *vertex =
         "#version 410 core\n"
         "uniform mat4 mvp;\n"
+        "uniform vec4 uv_rect;\n"
         "layout (location = 0) in vec3 vertex_position;\n"
         "layout (location = 1) in vec2 vertex_uv;\n"
         "out vec2 uv;\n"
         "void main() {\n"
-        "    uv = vertex_uv;\n"
+        "    uv = uv_rect.xy + vertex_uv * uv_rect.zw;\n"
         "    gl_Position = mvp * vec4(vertex_position, 1.0);\n"
         "}\n";
 
@@ -26,6 +28,39 @@ namespace {
         "    color = texture2D(tex, uv);\n"
         "}\n";
 
+    // 1つの描画で複数の矩形をinstancingで描く
+    // dstは描画先での位置(px)、srcはテクスチャ内の範囲
+    const char *batch_vertex =
+        "#version 410 core\n"
+        "uniform vec2 target;\n"
+        "layout (location = 0) in vec2 corner;\n"
+        "layout (location = 1) in vec4 dst;\n"
+        "layout (location = 2) in vec4 src;\n"
+        "out vec2 uv;\n"
+        "void main() {\n"
+        "    uv = src.xy + corner * src.zw;\n"
+        "    gl_Position = vec4((dst.xy + corner * dst.zw) / target * 2.0 - 1.0, 0.0, 1.0);\n"
+        "}\n";
+
+    const char *batch_frag =
+        "#version 410 core\n"
+        "in vec2 uv;\n"
+        "uniform sampler2D tex;\n"
+        "uniform bool multiply;\n"
+        "layout(location = 0, index = 0) out vec4 color;\n"
+        "layout(location = 0, index = 1) out vec4 factor;\n"
+        "void main() {\n"
+        "    vec4 src = texture(tex, uv);\n"
+        "    if (multiply) {\n"
+        "        color = vec4(0.0);\n"
+        "        factor = vec4(vec3(1.0 - src.a) + src.rgb, 1.0);\n"
+        "    }\n"
+        "    else {\n"
+        "        color = src;\n"
+        "        factor = vec4(1.0 - src.a);\n"
+        "    }\n"
+        "}\n";
+
     const float vertex_position[] = {
          1,  1,  0,
         -1,  1,  0,
@@ -40,14 +75,77 @@ namespace {
         1, 1,
     };
 
+    const GLfloat batch_corner[] = {
+        1, 1,
+        0, 1,
+        0, 0,
+        1, 0,
+    };
+
+    // 1つの矩形あたりのinstance属性
+    struct Instance {
+        GLfloat dst[4];
+        GLfloat src[4];
+    };
+
+    // テクスチャ同士の合成に使う
+    // 合成元、合成先ともに前乗算済みのalphaを持っている
+    // 乗算は合成先の色に掛ける係数を2つ目の出力(dual source)で渡す
+    void blend(Method method) {
+        switch (method) {
+            case Method::OverlayFast:
+                // 合成先の不透明な部分にだけ重ね、alphaは合成先のまま
+                glBlendFuncSeparate(GL_DST_ALPHA, GL_ONE_MINUS_SRC_ALPHA, GL_ZERO, GL_ONE);
+                break;
+            case Method::OverlayMultiply:
+                // 合成先の色 * (1 - 合成元のalpha + 合成元の色)
+                glBlendFuncSeparate(GL_ZERO, GL_SRC1_COLOR, GL_ZERO, GL_ONE);
+                break;
+            case Method::Replace:
+                glBlendFuncSeparate(GL_ONE, GL_ZERO, GL_ONE, GL_ZERO);
+                break;
+            case Method::Interpolate:
+                // 合成先の透明な部分にだけ下から重ねる
+                glBlendFuncSeparate(GL_ONE_MINUS_DST_ALPHA, GL_ONE, GL_ONE_MINUS_DST_ALPHA, GL_ONE);
+                break;
+            case Method::Reduce:
+                // 合成先のalphaに合成元のalphaを掛ける
+                glBlendFuncSeparate(GL_ZERO, GL_SRC_ALPHA, GL_ZERO, GL_SRC_ALPHA);
+                break;
+            case Method::Asis:
+                // 合成元のalphaを無視して色をそのまま置き、alphaは合成先のまま
+                glBlendFuncSeparate(GL_ONE, GL_ZERO, GL_ZERO, GL_ONE);
+                break;
+            default:
+                // Base、Overlay、Add、Bind、Insertなどは普通に重ねる
+                glBlendFuncSeparate(GL_ONE, GL_ONE_MINUS_SRC_ALPHA, GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+                break;
+        }
+    }
+
+    // blendで同じ設定になるものは同じ値を返す
+    int blendGroup(Method method) {
+        switch (method) {
+            case Method::OverlayFast:
+            case Method::OverlayMultiply:
+            case Method::Replace:
+            case Method::Interpolate:
+            case Method::Reduce:
+            case Method::Asis:
+                return static_cast<int>(method);
+            default:
+                return static_cast<int>(Method::Overlay);
+        }
+    }
+
     glm::mat4 projection = glm::ortho(-1.0, 1.0, -1.0, 1.0, -100.0, 100.0);
     glm::mat4 model = glm::mat4(1.0f);
 }
 
-bool Program::load() {
+GLuint Program::link(const char *vertex, const char *frag) {
     int success;
     char log[1024];
-    id_ = glCreateProgram();
+    GLuint id = glCreateProgram();
     assert(glGetError() == GL_NO_ERROR);
     const GLuint vshader = glCreateShader(GL_VERTEX_SHADER);
     assert(glGetError() == GL_NO_ERROR);
@@ -61,10 +159,10 @@ bool Program::load() {
         glGetShaderInfoLog(vshader, 1024, NULL, log);
         assert(glGetError() == GL_NO_ERROR);
         Logger::log("Error.Shader: ", log);
-        return false;
+        return 0;
     }
 
-    glAttachShader(id_, vshader);
+    glAttachShader(id, vshader);
     assert(glGetError() == GL_NO_ERROR);
     glDeleteShader(vshader);
     assert(glGetError() == GL_NO_ERROR);
@@ -81,24 +179,41 @@ bool Program::load() {
         glGetShaderInfoLog(fshader, 1024, NULL, log);
         assert(glGetError() == GL_NO_ERROR);
         Logger::log("Error.Shader: ", log);
-        return false;
+        return 0;
     }
-    glAttachShader(id_, fshader);
+    glAttachShader(id, fshader);
     assert(glGetError() == GL_NO_ERROR);
     glDeleteShader(fshader);
     assert(glGetError() == GL_NO_ERROR);
 
-    glLinkProgram(id_);
+    glLinkProgram(id);
     assert(glGetError() == GL_NO_ERROR);
-    glGetProgramiv(id_, GL_LINK_STATUS, &success);
+    glGetProgramiv(id, GL_LINK_STATUS, &success);
     assert(glGetError() == GL_NO_ERROR);
     if (!success) {
-        glGetProgramInfoLog(id_, 1024, NULL, log);
+        glGetProgramInfoLog(id, 1024, NULL, log);
         assert(glGetError() == GL_NO_ERROR);
         Logger::log("Error.Program: ", log);
+        return 0;
+    }
+    return id;
+}
+
+bool Program::load() {
+    id_ = link(vertex, frag);
+    if (id_ == 0) {
+        return false;
+    }
+    batch_id_ = link(batch_vertex, batch_frag);
+    if (batch_id_ == 0) {
         return false;
     }
 
+    tex_location_ = glGetUniformLocation(id_, "tex");
+    assert(glGetError() == GL_NO_ERROR);
+    uv_rect_location_ = glGetUniformLocation(id_, "uv_rect");
+    assert(glGetError() == GL_NO_ERROR);
+
     glGenVertexArrays(1, &vao_);
     assert(glGetError() == GL_NO_ERROR);
     glBindVertexArray(vao_);
@@ -122,10 +237,43 @@ bool Program::load() {
     assert(glGetError() == GL_NO_ERROR);
     glEnableVertexAttribArray(uv_location);
     assert(glGetError() == GL_NO_ERROR);
+
+    batch_target_location_ = glGetUniformLocation(batch_id_, "target");
+    assert(glGetError() == GL_NO_ERROR);
+    batch_tex_location_ = glGetUniformLocation(batch_id_, "tex");
+    assert(glGetError() == GL_NO_ERROR);
+    batch_multiply_location_ = glGetUniformLocation(batch_id_, "multiply");
+    assert(glGetError() == GL_NO_ERROR);
+    glGenVertexArrays(1, &batch_vao_);
+    assert(glGetError() == GL_NO_ERROR);
+    glBindVertexArray(batch_vao_);
+    assert(glGetError() == GL_NO_ERROR);
+    glGenBuffers(1, &batch_corner_vbo_);
+    glBindBuffer(GL_ARRAY_BUFFER, batch_corner_vbo_);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(batch_corner), batch_corner, GL_STATIC_DRAW);
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, 0);
+    assert(glGetError() == GL_NO_ERROR);
+    glEnableVertexAttribArray(0);
+    assert(glGetError() == GL_NO_ERROR);
+    glGenBuffers(1, &batch_instance_vbo_);
+    glBindBuffer(GL_ARRAY_BUFFER, batch_instance_vbo_);
+    assert(glGetError() == GL_NO_ERROR);
+    for (GLuint i = 1; i <= 2; i++) {
+        glEnableVertexAttribArray(i);
+        assert(glGetError() == GL_NO_ERROR);
+        glVertexAttribDivisor(i, 1);
+        assert(glGetError() == GL_NO_ERROR);
+    }
+    glBindVertexArray(0);
+    assert(glGetError() == GL_NO_ERROR);
     return true;
 }
 
 Program::~Program() {
+    glDeleteBuffers(1, &batch_instance_vbo_);
+    glDeleteBuffers(1, &batch_corner_vbo_);
+    glDeleteVertexArrays(1, &batch_vao_);
+    glDeleteProgram(batch_id_);
     glDeleteVertexArrays(1, &vao_);
     glDeleteProgram(id_);
 }
@@ -151,11 +299,78 @@ void Program::use(const glm::mat4 &view) {
     auto mvp = projection * view * model;
     glUniformMatrix4fv(glGetUniformLocation(id_, "mvp"), 1, GL_FALSE, glm::value_ptr(mvp));
     assert(glGetError() == GL_NO_ERROR);
+    glUniform1i(tex_location_, 0);
+    assert(glGetError() == GL_NO_ERROR);
+    // 他の箇所でbindされているかもしれないのでuseの度に忘れる
+    bound_ = 0;
+}
+
+// uvはテクスチャ内の描画に使う範囲
+void Program::set(GLuint id, const UVRect &uv) {
+    glUniform4f(uv_rect_location_, uv.x, uv.y, uv.width, uv.height);
+    assert(glGetError() == GL_NO_ERROR);
+    if (bound_ != id) {
+        glBindTexture(GL_TEXTURE_2D, id);
+        assert(glGetError() == GL_NO_ERROR);
+        bound_ = id;
+    }
 }
 
-void Program::set(GLuint id) {
-    glUniform1i(glGetUniformLocation(id_, "tex"), 0);
+// quadsを順に描く
+// 同じテクスチャかつ同じblendが続く間は1回の描画にまとめる
+void Program::draw(const std::vector<Quad> &quads, int width, int height) {
+    if (quads.empty()) {
+        return;
+    }
+    std::vector<Instance> instances;
+    instances.reserve(quads.size());
+    for (auto &q : quads) {
+        instances.push_back({
+                {static_cast<GLfloat>(q.dst.x), static_cast<GLfloat>(q.dst.y), static_cast<GLfloat>(q.dst.width), static_cast<GLfloat>(q.dst.height)},
+                {q.uv.x, q.uv.y, q.uv.width, q.uv.height}});
+    }
+    glUseProgram(batch_id_);
+    assert(glGetError() == GL_NO_ERROR);
+    glBindVertexArray(batch_vao_);
+    assert(glGetError() == GL_NO_ERROR);
+    glViewport(0, 0, width, height);
+    assert(glGetError() == GL_NO_ERROR);
+    glUniform2f(batch_target_location_, width, height);
+    assert(glGetError() == GL_NO_ERROR);
+    glUniform1i(batch_tex_location_, 0);
     assert(glGetError() == GL_NO_ERROR);
-    glBindTexture(GL_TEXTURE_2D, id);
+    glBindBuffer(GL_ARRAY_BUFFER, batch_instance_vbo_);
+    assert(glGetError() == GL_NO_ERROR);
+    glBufferData(GL_ARRAY_BUFFER, instances.size() * sizeof(Instance), instances.data(), GL_STREAM_DRAW);
+    assert(glGetError() == GL_NO_ERROR);
+    bound_ = 0;
+    size_t begin = 0;
+    while (begin < quads.size()) {
+        size_t end = begin + 1;
+        int group = blendGroup(quads[begin].method);
+        while (end < quads.size() && quads[end].texture == quads[begin].texture &&
+                blendGroup(quads[end].method) == group) {
+            end++;
+        }
+        // GL4.1にはbase instanceが無いので属性の開始位置をずらす
+        auto offset = begin * sizeof(Instance);
+        glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(Instance), reinterpret_cast<const void *>(offset + offsetof(Instance, dst)));
+        assert(glGetError() == GL_NO_ERROR);
+        glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, sizeof(Instance), reinterpret_cast<const void *>(offset + offsetof(Instance, src)));
+        assert(glGetError() == GL_NO_ERROR);
+        if (bound_ != quads[begin].texture) {
+            glBindTexture(GL_TEXTURE_2D, quads[begin].texture);
+            assert(glGetError() == GL_NO_ERROR);
+            bound_ = quads[begin].texture;
+        }
+        glUniform1i(batch_multiply_location_, quads[begin].method == Method::OverlayMultiply);
+        assert(glGetError() == GL_NO_ERROR);
+        blend(quads[begin].method);
+        assert(glGetError() == GL_NO_ERROR);
+        glDrawArraysInstanced(GL_TRIANGLE_FAN, 0, 4, end - begin);
+        assert(glGetError() == GL_NO_ERROR);
+        begin = end;
+    }
+    glBindVertexArray(0);
     assert(glGetError() == GL_NO_ERROR);
 }
@@ -5,24 +5,48 @@
 #include <glm/glm.hpp>
 #include <iostream>
 #include <string>
+#include <vector>
 
 #include "glad/glad.h"
+#include "misc.h"
 #include "texture.h"
 
+// 合成先のdstにテクスチャのuvの範囲を描く
+struct Quad {
+    GLuint texture;
+    UVRect uv;
+    Rect dst;
+    Method method;
+};
+
 class Program {
     private:
         GLuint id_;
         GLuint vao_;
         GLuint pos_vbo_;
         GLuint uv_vbo_;
+        GLint tex_location_;
+        GLint uv_rect_location_;
+        // 同じテクスチャを続けて使う場合はbindし直さない
+        GLuint bound_;
+        // テクスチャ同士の合成用
+        GLuint batch_id_;
+        GLuint batch_vao_;
+        GLuint batch_corner_vbo_;
+        GLuint batch_instance_vbo_;
+        GLint batch_target_location_;
+        GLint batch_tex_location_;
+        GLint batch_multiply_location_;
+        static GLuint link(const char *vertex, const char *frag);
     public:
-        Program() {
+        Program() : bound_(0) {
             load();
         }
         ~Program();
         bool load();
         void use(const glm::mat4 &view);
-        void set(GLuint id);
+        void set(GLuint id, const UVRect &uv = {0, 0, 1, 1});
+        void draw(const std::vector<Quad> &quads, int width, int height);
         operator GLuint() const {
             return id_;
         }
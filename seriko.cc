@@ -1,121 +1,201 @@
 #include "seriko.h"
 
 #include <algorithm>
+#include <deque>
 #include <iostream>
 
 #include "logger.h"
 
+namespace {
+    void flatten(const std::vector<RenderInfo> &list, std::vector<Element> &out, std::unordered_set<Element> &seen) {
+        for (auto &info : list) {
+            if (std::holds_alternative<Element>(info)) {
+                auto &e = std::get<Element>(info);
+                if (seen.insert(e).second) {
+                    out.push_back(e);
+                }
+            }
+            else {
+                flatten(std::get<ElementWithChildren>(info).children, out, seen);
+            }
+        }
+    }
+}
+
 void Seriko::update(bool change) {
     auto now = std::chrono::system_clock::now();
     int elapsed = (change) ? (0) : (std::chrono::duration_cast<std::chrono::milliseconds>(now - prev_time_).count());
     while (!process_.empty()) {
         process_.pop();
     }
-    for (auto &[k, v] : actors_) {
+    for (auto &actor : actors_) {
         if (change) {
-            v.activate(From::System);
+            actor.activate(From::System);
         }
-        push(k, elapsed);
+        push(actor.id(), elapsed);
     }
     while (!process_.empty()) {
         auto [k, t] = process_.top();
         process_.pop();
-        actors_.at(k).update(t);
+        findActor(k)->update(t);
+    }
+    for (auto &actor : actors_) {
+        if (actor.takeChanged()) {
+            generation_++;
+        }
     }
     prev_time_ = now;
+    dirty_ = false;
+}
+
+Actor *Seriko::findActor(int id) {
+    auto it = std::lower_bound(actors_.begin(), actors_.end(), id, [](const Actor &a, int id) {
+        return a.id() < id;
+    });
+    if (it == actors_.end() || it->id() != id) {
+        return nullptr;
+    }
+    return &*it;
+}
+
+// actors_はidの昇順に並んだアニメーション定義から作るので
+// そのまま二分探索できる
+void Seriko::resetActors(const SurfaceEntry &surface) {
+    generation_++;
+    actors_.clear();
+    auto anims = surfaces_->animations(surface);
+    actors_.reserve(anims.size());
+    for (auto &a : anims) {
+        actors_.emplace_back(a, surfaces_->patterns(a), this);
+    }
 }
 
 void Seriko::push(int id, int elapsed) {
-    if (!actors_.contains(id)) {
+    auto actor = findActor(id);
+    if (!actor) {
         return;
     }
-    auto &actor = actors_.at(id);
-    if (!actor.active()) {
+    if (!actor->active()) {
         return;
     }
     process_.push({id, elapsed});
 }
 
 bool Seriko::active(int id) {
-    if (!actors_.contains(id)) {
+    auto actor = findActor(id);
+    if (!actor) {
         Logger::log("id: ", id, " not found");
         return false;
     }
-    return actors_.at(id).active();
+    return actor->active();
 }
 
 void Seriko::activate(From from, int id, int elapsed) {
-    if (!actors_.contains(id)) {
+    auto actor = findActor(id);
+    if (!actor) {
         Logger::log("animation id: ", id , " not found");
         return;
     }
-    auto &actor = actors_.at(id);
-    if (actor.active()) {
+    if (actor->active()) {
         Logger::log("animation id: ", id , " already active");
         return;
     }
-    actor.activate(from);
+    actor->activate(from);
     push(id, elapsed);
+    dirty_ = true;
 }
 
 void Seriko::inactivate(int id) {
-    if (!actors_.contains(id)) {
+    auto actor = findActor(id);
+    if (!actor) {
         return;
     }
-    auto &actor = actors_.at(id);
-    actor.inactivate();
+    actor->inactivate();
+    dirty_ = true;
 }
 
-std::vector<RenderInfo> Seriko::get(int id) {
-    if (!surfaces_.contains(id)) {
-        return {};
+// 次にパターンが切り替わるまでの時間(ms)
+// 動いているアニメーションが無ければnullopt
+std::optional<int> Seriko::remain(int id) const {
+    if (!surfaces_->contains(id)) {
+        return std::nullopt;
     }
-    std::vector<RenderInfo> ret;
     if (current_id_ != id) {
-        current_id_ = id;
-        if (!surfaces_.contains(id)) {
-            return {};
+        return 0;
+    }
+    auto now = std::chrono::system_clock::now();
+    int elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(now - prev_time_).count();
+    std::optional<int> ret = std::nullopt;
+    for (auto &actor : actors_) {
+        auto wait = actor.remain();
+        if (!wait) {
+            continue;
+        }
+        int t = std::max(0, wait.value() - elapsed);
+        if (!ret || t < ret.value()) {
+            ret = t;
         }
-        auto &surface = surfaces_.at(id);
-        actors_.clear();
-        for (auto &[k, v] : surface.animation) {
-            Actor actor = {k, v, this};
-            actors_.emplace(k, actor);
+    }
+    return ret;
+}
+
+// 前回のupdateから何も変化し得ないならfalse
+// 無いサーフェスへ切り替えた場合も空のリストを作り直させる
+bool Seriko::needsUpdate(int id) const {
+    if (dirty_ || id != list_id_) {
+        return true;
+    }
+    auto t = remain(id);
+    return t && t.value() == 0;
+}
+
+// 前回から描画する内容が変わっていなければ作り直さずに返す
+const std::vector<RenderInfo> &Seriko::get(int id) {
+    auto surface = surfaces_->find(id);
+    if (!surface) {
+        if (list_id_ != id) {
+            list_id_ = id;
+            list_.clear();
+            generation_++;
+            list_generation_ = generation_;
         }
+        return list_;
+    }
+    if (current_id_ != id) {
+        current_id_ = id;
+        resetActors(*surface);
         updateBind();
         update(true);
     }
     else {
         update();
     }
-    auto &surface = surfaces_.at(id);
-    std::vector<int> list;
-    list.reserve(std::max(surface.element.size(), actors_.size()));
-    ret.reserve(surface.element.size());
-    // TODO background
-    for (auto &[k, _] : surface.element) {
-        list.emplace_back(k);
+    if (list_id_ != id) {
+        generation_++;
     }
-    std::sort(list.begin(), list.end());
-    for (auto i : list) {
-        ret.emplace_back(surface.element[i]);
+    else if (list_generation_ == generation_) {
+        return list_;
     }
-    list.clear();
-    int allocate = ret.size();
-    for (auto &[k, v] : actors_) {
-        list.emplace_back(k);
-        allocate += v.patterns().size();
+    list_id_ = id;
+    list_generation_ = generation_;
+    auto &ret = list_;
+    ret.clear();
+    auto elements = surfaces_->elements(*surface);
+    size_t allocate = elements.size();
+    for (auto &actor : actors_) {
+        allocate += actor.patterns().size();
     }
     ret.reserve(allocate);
-    std::sort(list.begin(), list.end());
-    std::unordered_set<int> done = {id};
-    for (auto i : list) {
-        auto &actor = actors_.at(i);
-        auto &interval = actor.interval();
+    // TODO background
+    for (auto &e : elements) {
+        ret.emplace_back(e);
+    }
+    std::vector<int> done = {id};
+    for (auto &actor : actors_) {
+        auto interval = actor.interval();
         if (interval.size() == 1 && interval.contains(Interval::Bind)) {
-            if (isBinding(i)) {
-                auto ps = actor.patterns();
-                for (auto &p : ps) {
+            if (isBinding(actor.id())) {
+                for (auto &p : actor.patterns()) {
                     ElementWithChildren e = { p.method, p.x, p.y, getElements(p.id, done) };
                     ret.emplace_back(e);
                 }
@@ -123,12 +203,12 @@ std::vector<RenderInfo> Seriko::get(int id) {
         }
 #if 0
         else if (actor.active()) {
-            auto p = actor.currentPattern();
+            auto &p = actor.currentPattern();
             ElementWithChildren e = { p.method, p.x, p.y, getElements(p.id, done) };
             ret.emplace_back(e);
         }
 #else
-        auto p = actor.currentPattern();
+        auto &p = actor.currentPattern();
         ElementWithChildren e = { p.method, p.x, p.y, getElements(p.id, done) };
         ret.emplace_back(e);
 #endif
@@ -136,28 +216,25 @@ std::vector<RenderInfo> Seriko::get(int id) {
     return ret;
 }
 
-std::vector<RenderInfo> Seriko::getElements(int id, std::unordered_set<int> &done) {
-    if (!surfaces_.contains(id)) {
+std::vector<RenderInfo> Seriko::getElements(int id, std::vector<int> &done) {
+    auto surface = surfaces_->find(id);
+    if (!surface) {
         return {};
     }
     std::vector<RenderInfo> ret;
-    auto &surface = surfaces_.at(id);
-    done.emplace(id);
+    done.push_back(id);
     // TODO background
-    for (auto &[_, v] : surface.element) {
-        ret.push_back(v);
-    }
-    std::vector<int> list;
-    for (auto &[k, _] : surface.animation) {
-        list.push_back(k);
+    auto elements = surfaces_->elements(*surface);
+    ret.reserve(elements.size());
+    for (auto &e : elements) {
+        ret.push_back(e);
     }
-    std::sort(list.begin(), list.end());
-    for (auto i : list) {
-        auto &interval = surface.animation[i].interval;
+    for (auto &a : surfaces_->animations(*surface)) {
+        auto &interval = a.interval;
         if (interval.size() == 1 && interval.contains(Interval::Bind)) {
-            auto ps = surface.animation[i].pattern;
-            for (auto &p : ps) {
-                if (!done.contains(p.id)) {
+            for (auto &p : surfaces_->patterns(a)) {
+                // 入れ子の深さ程度しか無いので線形探索で十分
+                if (std::find(done.begin(), done.end(), p.id) == done.end()) {
                     ElementWithChildren e = { p.method, p.x, p.y, getElements(p.id, done) };
                     ret.emplace_back(e);
                 }
@@ -167,64 +244,118 @@ std::vector<RenderInfo> Seriko::getElements(int id, std::unordered_set<int> &don
     return ret;
 }
 
+// idのサーフェスに切り替えた後で描かれ得る要素を、描かれそうな順に並べる
+// サーフェス自身、着せ替え(addidで連動するものを含む)、残りのアニメーションの順に辿り
+// Start、ParallelStart、AlternativeStartで始まるアニメーションは次に辿る
+std::vector<Element> Seriko::prefetch(int id) {
+    auto surface = surfaces_->find(id);
+    if (!surface) {
+        return {};
+    }
+    std::vector<Element> ret;
+    std::unordered_set<Element> seen;
+    std::vector<int> done = {id};
+    {
+        auto elements = surfaces_->elements(*surface);
+        flatten({elements.begin(), elements.end()}, ret, seen);
+    }
+    auto anims = surfaces_->animations(*surface);
+    auto find = [&anims](int id) -> const AnimationEntry * {
+        auto it = std::lower_bound(anims.begin(), anims.end(), id, [](const AnimationEntry &a, int id) {
+            return a.id < id;
+        });
+        if (it == anims.end() || it->id != id) {
+            return nullptr;
+        }
+        return &*it;
+    };
+    auto binding = [this](int id) {
+        // まだこのサーフェスを描いていなければ親から引く
+        return binds_.contains(id) ? isBinding(id) : parent_->isBinding(id);
+    };
+    std::deque<int> queue;
+    for (auto &a : anims) {
+        if (a.interval.contains(Interval::Bind) && binding(a.id)) {
+            queue.push_back(a.id);
+        }
+    }
+    std::unordered_set<int> visited;
+    size_t next = 0;
+    while (true) {
+        if (queue.empty()) {
+            if (next == anims.size()) {
+                break;
+            }
+            queue.push_back(anims[next++].id);
+        }
+        int k = queue.front();
+        queue.pop_front();
+        auto a = find(k);
+        if (!a || !visited.insert(k).second) {
+            continue;
+        }
+        if (a->interval.contains(Interval::Bind) && binding(k)) {
+            for (auto e : parent_->getBindAddId(k)) {
+                queue.push_front(e);
+            }
+        }
+        for (auto &p : surfaces_->patterns(*a)) {
+            switch (p.method) {
+                case Method::Start:
+                case Method::ParallelStart:
+                case Method::AlternativeStart:
+                    for (auto e : p.ids) {
+                        queue.push_back(e);
+                    }
+                    break;
+                default:
+                    break;
+            }
+            if (std::find(done.begin(), done.end(), p.id) == done.end()) {
+                flatten(getElements(p.id, done), ret, seen);
+            }
+        }
+    }
+    return ret;
+}
+
 std::vector<CollisionInfo> Seriko::getCollision(int id) {
-    if (!surfaces_.contains(id)) {
+    auto surface = surfaces_->find(id);
+    if (!surface) {
         return {};
     }
+    // ここで進めたアニメーションはまだ描いていないので
+    // 次のdrawで描き直すようにしておく
+    bool dirty = dirty_;
+    auto generation = generation_;
     if (current_id_ != id) {
         current_id_ = id;
-        if (!surfaces_.contains(id)) {
-            return {};
-        }
-        auto &surface = surfaces_.at(id);
-        actors_.clear();
-        for (auto &[k, v] : surface.animation) {
-            Actor actor = {k, v, this};
-            actors_.emplace(k, actor);
-        }
+        resetActors(*surface);
         update(true);
     }
     else {
         update();
     }
+    dirty_ = dirty || generation != generation_;
     std::vector<CollisionInfo> ret;
     // TODO order
-    // 当たり判定は定義順の逆順で走査するので判定式も逆
-    auto comp = [](const Collision &a, const Collision &b) {
-        return a.factor > b.factor;
-    };
-    auto &surface = surfaces_.at(id);
+    // 各サーフェスの当たり判定は判定する順に並べてある
     // TODO background
     {
-        CollisionInfo info = {0, 0, {}};
-        for (auto &[_, v] : surface.collision) {
-            info.list.push_back(v);
+        auto collisions = surfaces_->collisions(*surface);
+        if (collisions.size() > 0) {
+            ret.push_back({0, 0, {collisions.begin(), collisions.end()}});
         }
-        if (info.list.size() > 0) {
-            std::sort(info.list.begin(), info.list.end(), comp);
-            ret.push_back(info);
-        }
-    }
-    std::vector<int> keys;
-    for (auto &[k, _] : actors_) {
-        keys.push_back(k);
     }
-    std::sort(keys.begin(), keys.end());
-    for (auto i : keys) {
-        auto &actor = actors_.at(i);
-        auto p = actor.currentPattern();
-        int id = p.id;
-        if (!surfaces_.contains(id)) {
+    for (auto &actor : actors_) {
+        auto &p = actor.currentPattern();
+        auto s = surfaces_->find(p.id);
+        if (!s) {
             continue;
         }
-        auto &s = surfaces_.at(id);
-        CollisionInfo info = {p.x, p.y, {}};
-        for (auto &[_, v] : s.collision) {
-            info.list.push_back(v);
-        }
-        if (info.list.size() > 0) {
-            std::sort(info.list.begin(), info.list.end(), comp);
-            ret.push_back(info);
+        auto collisions = surfaces_->collisions(*s);
+        if (collisions.size() > 0) {
+            ret.push_back({p.x, p.y, {collisions.begin(), collisions.end()}});
         }
     }
     // ここも逆順にする
@@ -232,17 +363,19 @@ std::vector<CollisionInfo> Seriko::getCollision(int id) {
     return ret;
 }
 
-
 void Seriko::bind(int id, bool enable) {
-    if (!actors_.contains(id)) {
+    auto actor = findActor(id);
+    if (!actor) {
         return;
     }
     binds_[id] = enable;
+    dirty_ = true;
+    generation_++;
     if (enable) {
-        actors_.at(id).activate(From::System);
+        actor->activate(From::System);
     }
     else {
-        actors_.at(id).inactivate();
+        actor->inactivate();
     }
     auto addids = parent_->getBindAddId(id);
     for (auto e : addids) {
@@ -268,7 +401,8 @@ bool Seriko::isBinding(int id) {
 }
 
 void Seriko::updateBind() {
-    for (auto &[k, _] : actors_) {
+    for (auto &actor : actors_) {
+        int k = actor.id();
         if (!binds_.contains(k)) {
             binds_[k] = parent_->isBinding(k);
             bind(k, binds_.at(k));
@@ -1,7 +1,11 @@
 #ifndef SERIKO_H_
 #define SERIKO_H_
 
+#include <chrono>
+#include <cstdint>
 #include <iostream>
+#include <memory>
+#include <optional>
 #include <queue>
 #include <variant>
 #include <vector>
@@ -10,6 +14,7 @@
 #include "character.h"
 #include "element.h"
 #include "surface.h"
+#include "surface_table.h"
 
 class Actor;
 
@@ -34,17 +39,28 @@ class Character;
 class Seriko {
     private:
         int current_id_;
-        std::unordered_map<int, Surface> surfaces_;
-        std::unordered_map<int, Actor> actors_;
+        bool dirty_;
+        // get()で返す内容が変わる度に増やす
+        uint64_t generation_;
+        // list_を作った時のidとgeneration_
+        int list_id_;
+        uint64_t list_generation_;
+        std::vector<RenderInfo> list_;
+        // 全てのキャラクターで共有する読み取り専用の定義
+        std::shared_ptr<const SurfaceTable> surfaces_;
+        // idの昇順
+        std::vector<Actor> actors_;
         std::chrono::system_clock::time_point prev_time_;
         std::priority_queue<ActorWithPriority, std::vector<ActorWithPriority>, Compare> process_;
         Character *parent_;
         std::unordered_map<int, bool> binds_;
         std::unordered_map<int, std::unordered_set<int>> bind_addids_;
+        Actor *findActor(int id);
+        void resetActors(const SurfaceEntry &surface);
         void update(bool change = false);
         void updateBind();
     public:
-        Seriko(const std::unordered_map<int, Surface> &surfaces) : current_id_(-1), surfaces_(surfaces) {}
+        Seriko(std::shared_ptr<const SurfaceTable> surfaces) : current_id_(-1), dirty_(false), generation_(0), list_id_(-1), list_generation_(0), surfaces_(std::move(surfaces)) {}
         ~Seriko() {}
         void setParent(Character *parent) {
             parent_ = parent;
@@ -53,8 +69,18 @@ class Seriko {
         bool active(int id);
         void activate(From from, int id, int elapsed);
         void inactivate(int id);
-        std::vector<RenderInfo> get(int id);
-        std::vector<RenderInfo> getElements(int id, std::unordered_set<int> &done);
+        std::optional<int> remain(int id) const;
+        bool needsUpdate(int id) const;
+        const std::vector<RenderInfo> &get(int id);
+        uint64_t generation() const {
+            return generation_;
+        }
+        // 最後にgetで作ったリストのid
+        int listId() const {
+            return list_id_;
+        }
+        std::vector<RenderInfo> getElements(int id, std::vector<int> &done);
+        std::vector<Element> prefetch(int id);
         std::vector<CollisionInfo> getCollision(int id);
         void bind(int id, bool enable);
         bool isBinding(int id);
@@ -0,0 +1,83 @@
+#include "sprite_surface.h"
+
+#if defined(USE_WAYLAND)
+
+#include "logger.h"
+
+SpriteSurface::SpriteSurface(wl_compositor *compositor, wl_subcompositor *subcompositor, wl_surface *parent, EGLDisplay display, EGLContext context)
+    : parent_(parent), surface_(nullptr), subsurface_(nullptr), window_(nullptr),
+    display_(display), context_(context), egl_surface_(EGL_NO_SURFACE),
+    size_({1, 1}), position_({0, 0}) {
+    if (compositor == nullptr || subcompositor == nullptr || parent == nullptr ||
+            display == EGL_NO_DISPLAY || context == EGL_NO_CONTEXT) {
+        return;
+    }
+    // ウィンドウと同じ設定で作らないと同じcontextで描けない
+    EGLint id = 0;
+    if (!eglQueryContext(display_, context_, EGL_CONFIG_ID, &id)) {
+        return;
+    }
+    EGLint attributes[] = {EGL_CONFIG_ID, id, EGL_NONE};
+    EGLConfig config;
+    EGLint n = 0;
+    if (!eglChooseConfig(display_, attributes, &config, 1, &n) || n == 0) {
+        return;
+    }
+    surface_ = wl_compositor_create_surface(compositor);
+    subsurface_ = wl_subcompositor_get_subsurface(subcompositor, surface_, parent_);
+    // ウィンドウ本体の更新を待たずに反映させる
+    wl_subsurface_set_desync(subsurface_);
+    // 入力はウィンドウ本体で受け取る
+    wl_region *region = wl_compositor_create_region(compositor);
+    wl_surface_set_input_region(surface_, region);
+    wl_region_destroy(region);
+    window_ = wl_egl_window_create(surface_, size_.x, size_.y);
+    egl_surface_ = eglCreateWindowSurface(display_, config, reinterpret_cast<EGLNativeWindowType>(window_), nullptr);
+    if (egl_surface_ == EGL_NO_SURFACE) {
+        Logger::log("SpriteSurface: failed to create EGLSurface");
+        return;
+    }
+    // 表示されていない間に交換を待ち続けないようにする
+    makeCurrent();
+    eglSwapInterval(display_, 0);
+}
+
+SpriteSurface::~SpriteSurface() {
+    if (egl_surface_ != EGL_NO_SURFACE) {
+        eglDestroySurface(display_, egl_surface_);
+    }
+    if (window_) {
+        wl_egl_window_destroy(window_);
+    }
+    if (subsurface_) {
+        wl_subsurface_destroy(subsurface_);
+    }
+    if (surface_) {
+        wl_surface_destroy(surface_);
+    }
+}
+
+bool SpriteSurface::resize(int width, int height) {
+    if (size_.x == width && size_.y == height) {
+        return false;
+    }
+    size_ = {width, height};
+    wl_egl_window_resize(window_, width, height, 0, 0);
+    return true;
+}
+
+// 位置はウィンドウ本体をcommitした時に反映される
+void SpriteSurface::move(int x, int y) {
+    if (position_.x == x && position_.y == y) {
+        return;
+    }
+    position_ = {x, y};
+    wl_subsurface_set_position(subsurface_, x, y);
+    wl_surface_commit(parent_);
+}
+
+void SpriteSurface::makeCurrent() {
+    eglMakeCurrent(display_, egl_surface_, egl_surface_, context_);
+}
+
+#endif // USE_WAYLAND
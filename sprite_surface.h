@@ -0,0 +1,43 @@
+#ifndef SPRITE_SURFACE_H_
+#define SPRITE_SURFACE_H_
+
+#if defined(USE_WAYLAND)
+
+#include <EGL/egl.h>
+#include <wayland-client.h>
+#include <wayland-egl.h>
+
+#include "misc.h"
+
+// ウィンドウの上に置くキャラクターの大きさだけのsubsurface
+// ウィンドウ本体(画面全体の大きさ)には透明な内容を1度描くだけにして
+// 毎フレームの描画はこちらで行う
+class SpriteSurface {
+    private:
+        wl_surface *parent_;
+        wl_surface *surface_;
+        wl_subsurface *subsurface_;
+        wl_egl_window *window_;
+        EGLDisplay display_;
+        EGLContext context_;
+        EGLSurface egl_surface_;
+        Position<int> size_;
+        Offset position_;
+    public:
+        SpriteSurface(wl_compositor *compositor, wl_subcompositor *subcompositor, wl_surface *parent, EGLDisplay display, EGLContext context);
+        ~SpriteSurface();
+        operator bool() const {
+            return egl_surface_ != EGL_NO_SURFACE;
+        }
+        // 大きさが変わった場合はtrue
+        bool resize(int width, int height);
+        void move(int x, int y);
+        void makeCurrent();
+        EGLSurface surface() const {
+            return egl_surface_;
+        }
+};
+
+#endif // USE_WAYLAND
+
+#endif // SPRITE_SURFACE_H_
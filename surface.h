@@ -1,7 +1,10 @@
 #ifndef SURFACE_H_
 #define SURFACE_H_
 
+#include <bit>
+#include <cstdint>
 #include <filesystem>
+#include <initializer_list>
 #include <optional>
 #include <string>
 #include <unordered_map>
@@ -9,29 +12,68 @@
 #include <vector>
 
 #include "misc.h"
+#include "util.h"
 
 struct Element {
     Method method;
     int x, y;
-    std::filesystem::path filename;
+    // ImagePathで振った画像のid
+    uint32_t image;
+    // 描画の度に計算しないようにSurfaceTableを作る時に求めておく
+    size_t hash = 0;
+    void rehash() {
+        hash = image;
+        util::hashCombine(hash, static_cast<size_t>(method));
+        util::hashCombine(hash, x);
+        util::hashCombine(hash, y);
+    }
     bool operator==(const Element &rhs) const {
         const auto &lhs = *this;
-        return lhs.method == rhs.method && lhs.x == rhs.x && lhs.y == rhs.y && lhs.filename == rhs.filename;
+        return lhs.hash == rhs.hash && lhs.method == rhs.method && lhs.x == rhs.x && lhs.y == rhs.y && lhs.image == rhs.image;
     }
 };
 
 template<>
 struct std::hash<Element> {
     size_t operator()(const Element &e) const {
-        size_t ret = 0;
-        ret ^= std::hash<Method>()(e.method);
-        ret ^= std::hash<int>()(e.x);
-        ret ^= std::hash<int>()(e.y);
-        ret ^= std::hash<std::string>()(e.filename.string());
-        return ret;
+        return e.hash;
     }
 };
 
+// Intervalの集合をビットで持つ
+class IntervalSet {
+    private:
+        uint32_t bits_;
+    public:
+        constexpr IntervalSet() : bits_(0) {}
+        constexpr IntervalSet(std::initializer_list<Interval> list) : bits_(0) {
+            for (auto i : list) {
+                emplace(i);
+            }
+        }
+        static constexpr IntervalSet fromBits(uint32_t bits) {
+            IntervalSet set;
+            set.bits_ = bits;
+            return set;
+        }
+        constexpr void emplace(Interval i) {
+            bits_ |= 1u << static_cast<int>(i);
+        }
+        constexpr bool contains(Interval i) const {
+            return bits_ & (1u << static_cast<int>(i));
+        }
+        // 1つでも共通するものがあるか
+        constexpr bool intersects(IntervalSet other) const {
+            return bits_ & other.bits_;
+        }
+        constexpr size_t size() const {
+            return std::popcount(bits_);
+        }
+        constexpr uint32_t bits() const {
+            return bits_;
+        }
+};
+
 struct Pattern {
     Method method;
     int id, wait_min, wait_max, x, y;
@@ -39,7 +81,7 @@ struct Pattern {
 };
 
 struct Animation {
-    std::unordered_set<Interval> interval;
+    IntervalSet interval;
     int interval_factor;
     std::vector<Pattern> pattern;
     std::optional<std::vector<int>> exclusive;
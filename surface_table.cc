@@ -0,0 +1,109 @@
+#include "surface_table.h"
+
+#include <algorithm>
+
+namespace {
+    template<typename T>
+        std::vector<int> sortedKeys(const std::unordered_map<int, T> &map) {
+            std::vector<int> keys;
+            keys.reserve(map.size());
+            for (auto &[k, _] : map) {
+                keys.push_back(k);
+            }
+            std::sort(keys.begin(), keys.end());
+            return keys;
+        }
+
+    template<typename T>
+        bool inside(const std::vector<T> &v, Range r) {
+            return r.offset <= v.size() && r.size <= v.size() - r.offset;
+        }
+}
+
+SurfaceTable::SurfaceTable(const std::unordered_map<int, Surface> &surfaces) {
+    size_t elements = 0, animations = 0, patterns = 0, collisions = 0;
+    for (auto &[_, s] : surfaces) {
+        elements += s.element.size();
+        animations += s.animation.size();
+        collisions += s.collision.size();
+        for (auto &[_, a] : s.animation) {
+            patterns += a.pattern.size();
+        }
+    }
+    surfaces_.reserve(surfaces.size());
+    elements_.reserve(elements);
+    animations_.reserve(animations);
+    patterns_.reserve(patterns);
+    collisions_.reserve(collisions);
+
+    for (auto id : sortedKeys(surfaces)) {
+        auto &s = surfaces.at(id);
+        SurfaceEntry entry = {id, {}, {}, {}};
+
+        entry.element.offset = elements_.size();
+        for (auto k : sortedKeys(s.element)) {
+            elements_.push_back(s.element.at(k));
+            elements_.back().rehash();
+        }
+        entry.element.size = elements_.size() - entry.element.offset;
+
+        entry.animation.offset = animations_.size();
+        for (auto k : sortedKeys(s.animation)) {
+            auto &a = s.animation.at(k);
+            AnimationEntry anim = {k, a.interval, a.interval_factor, {}, a.exclusive, a.background, a.shared_index};
+            anim.pattern.offset = patterns_.size();
+            patterns_.insert(patterns_.end(), a.pattern.begin(), a.pattern.end());
+            anim.pattern.size = a.pattern.size();
+            animations_.push_back(std::move(anim));
+        }
+        entry.animation.size = animations_.size() - entry.animation.offset;
+
+        // 当たり判定は定義順の逆順で走査するので判定式も逆
+        entry.collision.offset = collisions_.size();
+        for (auto &[_, c] : s.collision) {
+            collisions_.push_back(c);
+        }
+        entry.collision.size = collisions_.size() - entry.collision.offset;
+        std::sort(collisions_.begin() + entry.collision.offset, collisions_.end(), [](const Collision &a, const Collision &b) {
+            return a.factor > b.factor;
+        });
+
+        surfaces_.push_back(entry);
+    }
+}
+
+const SurfaceEntry *SurfaceTable::find(int id) const {
+    auto it = std::lower_bound(surfaces_.begin(), surfaces_.end(), id, [](const SurfaceEntry &s, int id) {
+        return s.id < id;
+    });
+    if (it == surfaces_.end() || it->id != id) {
+        return nullptr;
+    }
+    return &*it;
+}
+
+// キャッシュから読み込んだ時に範囲外を指していないか調べる
+bool SurfaceTable::valid() const {
+    for (size_t i = 0; i < surfaces_.size(); i++) {
+        auto &s = surfaces_[i];
+        if (i > 0 && surfaces_[i - 1].id >= s.id) {
+            return false;
+        }
+        if (!inside(elements_, s.element) || !inside(animations_, s.animation) ||
+                !inside(collisions_, s.collision)) {
+            return false;
+        }
+        auto anims = animations(s);
+        for (size_t j = 1; j < anims.size(); j++) {
+            if (anims[j - 1].id >= anims[j].id) {
+                return false;
+            }
+        }
+    }
+    for (auto &a : animations_) {
+        if (!inside(patterns_, a.pattern)) {
+            return false;
+        }
+    }
+    return true;
+}
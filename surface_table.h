@@ -0,0 +1,78 @@
+#ifndef SURFACE_TABLE_H_
+#define SURFACE_TABLE_H_
+
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <unordered_map>
+#include <vector>
+
+#include "surface.h"
+
+// 連続領域中の位置
+struct Range {
+    uint32_t offset, size;
+};
+
+struct AnimationEntry {
+    int id;
+    IntervalSet interval;
+    int interval_factor;
+    Range pattern;
+    std::optional<std::vector<int>> exclusive;
+    bool background;
+    bool shared_index;
+};
+
+struct SurfaceEntry {
+    int id;
+    Range element;
+    Range animation;
+    Range collision;
+};
+
+// 解析済みのサーフェス定義を読み取り専用の形にしたもの
+// サーフェスはidの昇順に並べて二分探索で引く
+// element、animationはid順、collisionは判定する順に並べておくので
+// 描画時にハッシュを引いたり並べ替えたりする必要が無い
+class SurfaceTable {
+    private:
+        std::vector<SurfaceEntry> surfaces_;
+        std::vector<Element> elements_;
+        std::vector<AnimationEntry> animations_;
+        std::vector<Pattern> patterns_;
+        std::vector<Collision> collisions_;
+
+        template<typename T>
+            static std::span<const T> slice(const std::vector<T> &v, Range r) {
+                return {v.data() + r.offset, r.size};
+            }
+
+        friend class SurfacesCache;
+    public:
+        SurfaceTable() {}
+        SurfaceTable(const std::unordered_map<int, Surface> &surfaces);
+        ~SurfaceTable() {}
+        const SurfaceEntry *find(int id) const;
+        bool contains(int id) const {
+            return find(id) != nullptr;
+        }
+        std::span<const SurfaceEntry> surfaces() const {
+            return surfaces_;
+        }
+        std::span<const Element> elements(const SurfaceEntry &s) const {
+            return slice(elements_, s.element);
+        }
+        std::span<const AnimationEntry> animations(const SurfaceEntry &s) const {
+            return slice(animations_, s.animation);
+        }
+        std::span<const Collision> collisions(const SurfaceEntry &s) const {
+            return slice(collisions_, s.collision);
+        }
+        std::span<const Pattern> patterns(const AnimationEntry &a) const {
+            return slice(patterns_, a.pattern);
+        }
+        bool valid() const;
+};
+
+#endif // SURFACE_TABLE_H_
@@ -8,6 +8,7 @@
 #include <unordered_map>
 
 #include "logger.h"
+#include "surfaces_cache.h"
 #include "util.h"
 
 enum class State { Root, Descript, Surface, None };
@@ -136,8 +137,9 @@ void parseSurfaceID(const std::string &line, std::unordered_set<int> &inclusive,
     }
 }
 
-Surfaces::Surfaces(const std::filesystem::path &ayu_dir) {
+Surfaces::Surfaces(const std::filesystem::path &ayu_dir) : version_(0) {
     std::vector<std::filesystem::path> list;
+    std::vector<std::pair<int, std::filesystem::path>> images;
     assert(std::filesystem::is_directory(ayu_dir));
     for (const auto &e : std::filesystem::directory_iterator(ayu_dir)) {
         if (e.is_regular_file()) {
@@ -156,7 +158,7 @@ Surfaces::Surfaces(const std::filesystem::path &ayu_dir) {
                 if (valid) {
                     int n;
                     util::to_x(s, n);
-                    addSurface(n, e.path());
+                    images.emplace_back(n, e.path());
                 }
             }
             else if (path.starts_with("surfaces") && path.ends_with(".txt")) {
@@ -165,12 +167,29 @@ Surfaces::Surfaces(const std::filesystem::path &ayu_dir) {
         }
     }
     std::sort(list.begin(), list.end(), std::less<std::filesystem::path>());
-    for (auto &p : list) {
-        parse(p);
+    std::sort(images.begin(), images.end());
+    // 画像の追加・削除でも結果が変わるのでキーに含める
+    std::vector<std::filesystem::path> sources = list;
+    for (auto &[_, p] : images) {
+        sources.push_back(p);
     }
+    SurfaceTable table;
+    SurfacesCache cache(ayu_dir, sources);
+    if (!cache.load(version_, table, alias_)) {
+        std::unordered_map<int, Surface> surfaces;
+        for (auto &[n, p] : images) {
+            addSurface(surfaces, n, p);
+        }
+        for (auto &p : list) {
+            parse(surfaces, p);
+        }
+        table = SurfaceTable(surfaces);
+        cache.save(version_, table, alias_);
+    }
+    surfaces_ = std::make_shared<const SurfaceTable>(std::move(table));
 }
 
-void Surfaces::parse(const std::filesystem::path &path) {
+void Surfaces::parse(std::unordered_map<int, Surface> &surfaces, const std::filesystem::path &path) {
     std::filesystem::path shell_dir = path.parent_path();
     std::ifstream ifs(path);
     std::string data;
@@ -266,7 +285,7 @@ void Surfaces::parse(const std::filesystem::path &path) {
                     element.method = s2method_synthesize.at(tmp);
                     std::getline(l, tmp, ',');
                     std::u8string u(tmp.begin(), tmp.end());
-                    element.filename = shell_dir / u;
+                    element.image = ImagePath::intern(shell_dir / u);
                     std::getline(l, tmp, ',');
                     util::to_x(tmp, element.x);
                     std::getline(l, tmp, ',');
@@ -285,7 +304,7 @@ void Surfaces::parse(const std::filesystem::path &path) {
                             Logger::log("Error(", line_count, "): invalid method in animation");
                             continue;
                         }
-                        Animation animation;
+                        Animation animation = {};
                         std::getline(l, tmp, ',');
                         std::istringstream l2(tmp);
                         while (std::getline(l2, tmp, '+')) {
@@ -309,7 +328,7 @@ void Surfaces::parse(const std::filesystem::path &path) {
                         }
                         int n;
                         util::to_x(tmp.substr(7), n);
-                        Pattern p;
+                        Pattern p = {};
                         std::getline(l, tmp, ',');
                         if (surface->animation[id].interval.size() == 1 && surface->animation[id].interval.contains(Interval::Bind) && !s2method_synthesize.contains(tmp)) {
                             Logger::log("Error(", line_count, "): invalid method in bind");
@@ -461,10 +480,10 @@ void Surfaces::parse(const std::filesystem::path &path) {
                         if (exclusive.contains(e)) {
                             continue;
                         }
-                        if (append && !surfaces_.contains(e)) {
+                        if (append && !surfaces.contains(e)) {
                             continue;
                         }
-                        surfaces_[e].merge(*surface);
+                        surfaces[e].merge(*surface);
                     }
                 }
                 break;
@@ -483,17 +502,13 @@ std::unique_ptr<Seriko> Surfaces::getSeriko() const {
 }
 
 void Surfaces::dump() const {
-    for (auto &[k, v] : surfaces_) {
-        Logger::log("surface: ", k);
-        for (auto &[k, e] : v.element) {
-            Logger::log("  element", k);
-        }
-        for (auto &[k, a] : v.animation) {
-            Logger::log("  animation: ", k);
-            Logger::log("    pattern: " , a.pattern.size());
-        }
-        for (auto &[k, c] : v.collision) {
-            Logger::log("  collision: ", k);
+    for (auto &s : surfaces_->surfaces()) {
+        Logger::log("surface: ", s.id);
+        Logger::log("  element: ", s.element.size);
+        for (auto &a : surfaces_->animations(s)) {
+            Logger::log("  animation: ", a.id);
+            Logger::log("    pattern: " , a.pattern.size);
         }
+        Logger::log("  collision: ", s.collision.size);
     }
 }
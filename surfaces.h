@@ -2,27 +2,31 @@
 #define SURFACES_H_
 
 #include <filesystem>
+#include <memory>
 #include <string>
 #include <unordered_map>
 #include <vector>
 
+#include "image_path.h"
 #include "seriko.h"
 #include "surface.h"
+#include "surface_table.h"
 
 class Seriko;
 
 class Surfaces {
     private:
         int version_;
-        std::unordered_map<int, Surface> surfaces_;
+        // 読み込み後は変更しないので各キャラクターのSerikoで共有する
+        std::shared_ptr<const SurfaceTable> surfaces_;
         std::unordered_map<std::string, std::vector<int>> alias_;
+        void addSurface(std::unordered_map<int, Surface> &surfaces, int n, const std::filesystem::path path) {
+            surfaces[n].element[0] = {Method::Base, 0, 0, ImagePath::intern(path)};
+        }
+        void parse(std::unordered_map<int, Surface> &surfaces, const std::filesystem::path &path);
     public:
         Surfaces(const std::filesystem::path &ayu_dir);
         ~Surfaces() {}
-        void addSurface(int n, const std::filesystem::path path) {
-            surfaces_[n].element[0] = {Method::Base, 0, 0, path};
-        }
-        void parse(const std::filesystem::path &path);
         std::unique_ptr<Seriko> getSeriko() const;
         void dump() const;
 };
@@ -0,0 +1,315 @@
+#include "surfaces_cache.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <string_view>
+
+#include "image_path.h"
+#include "logger.h"
+#include "util.h"
+
+namespace {
+    const char magic[4] = {'A', 'Y', 'U', 'S'};
+    // 保存形式を変えたら上げる
+    const uint32_t format_version = 2;
+
+    // 整数は全てリトルエンディアンで書く
+    class Writer {
+        private:
+            std::string &out_;
+        public:
+            Writer(std::string &out) : out_(out) {}
+            void u32(uint32_t v) {
+                for (int i = 0; i < 4; i++) {
+                    out_.push_back(static_cast<char>((v >> (i * 8)) & 0xff));
+                }
+            }
+            void u64(uint64_t v) {
+                u32(static_cast<uint32_t>(v));
+                u32(static_cast<uint32_t>(v >> 32));
+            }
+            void i32(int v) {
+                u32(static_cast<uint32_t>(v));
+            }
+            void str(std::string_view s) {
+                u32(s.size());
+                out_.append(s);
+            }
+            void ints(const std::vector<int> &v) {
+                u32(v.size());
+                for (auto i : v) {
+                    i32(i);
+                }
+            }
+    };
+
+    // 範囲外を読もうとしたら以降は全て失敗させる
+    class Reader {
+        private:
+            std::string_view data_;
+            size_t pos_;
+            bool ok_;
+        public:
+            Reader(std::string_view data) : data_(data), pos_(0), ok_(true) {}
+            bool ok() const {
+                return ok_;
+            }
+            bool end() const {
+                return pos_ == data_.size();
+            }
+            uint32_t u32() {
+                if (!ok_ || data_.size() - pos_ < 4) {
+                    ok_ = false;
+                    return 0;
+                }
+                uint32_t v = 0;
+                for (int i = 0; i < 4; i++) {
+                    v |= static_cast<uint32_t>(static_cast<unsigned char>(data_[pos_ + i])) << (i * 8);
+                }
+                pos_ += 4;
+                return v;
+            }
+            int i32() {
+                return static_cast<int>(u32());
+            }
+            // 壊れたファイルで巨大な領域を確保しないように
+            // 残りのサイズを超える個数は不正とする
+            size_t count(size_t unit) {
+                size_t n = u32();
+                if (!ok_ || n > (data_.size() - pos_) / unit) {
+                    ok_ = false;
+                    return 0;
+                }
+                return n;
+            }
+            std::string str() {
+                size_t n = count(1);
+                if (!ok_) {
+                    return {};
+                }
+                std::string s(data_.substr(pos_, n));
+                pos_ += n;
+                return s;
+            }
+            std::vector<int> ints() {
+                size_t n = count(4);
+                std::vector<int> v;
+                v.reserve(n);
+                for (size_t i = 0; i < n; i++) {
+                    v.push_back(i32());
+                }
+                return v;
+            }
+            bool match(std::string_view s) {
+                if (!ok_ || data_.substr(pos_, s.size()) != s) {
+                    ok_ = false;
+                    return false;
+                }
+                pos_ += s.size();
+                return true;
+            }
+    };
+
+    template<typename T>
+        T toEnum(int v, int max) {
+            return static_cast<T>((v < 0 || v > max) ? 0 : v);
+        }
+
+    void writeRange(Writer &w, Range r) {
+        w.u32(r.offset);
+        w.u32(r.size);
+    }
+
+    Range readRange(Reader &r) {
+        Range range;
+        range.offset = r.u32();
+        range.size = r.u32();
+        return range;
+    }
+}
+
+SurfacesCache::SurfacesCache(const std::filesystem::path &ayu_dir, const std::vector<std::filesystem::path> &sources) {
+    auto dir = util::cacheDir();
+    if (dir.empty()) {
+        return;
+    }
+    std::string name = std::filesystem::absolute(ayu_dir).string();
+    char hash[17];
+    snprintf(hash, sizeof(hash), "%016llx", static_cast<unsigned long long>(util::fnv1a(name.c_str(), name.size())));
+    path_ = dir / (std::string(hash) + ".surfaces");
+
+    Writer w(key_);
+    w.str(name);
+    w.u32(sources.size());
+    std::error_code ec;
+    for (auto &p : sources) {
+        w.str(p.filename().string());
+        auto size = std::filesystem::file_size(p, ec);
+        w.u64(ec ? 0 : size);
+        auto time = std::filesystem::last_write_time(p, ec);
+        w.u64(ec ? 0 : time.time_since_epoch().count());
+    }
+}
+
+bool SurfacesCache::load(int &version, SurfaceTable &table, std::unordered_map<std::string, std::vector<int>> &alias) const {
+    if (path_.empty()) {
+        return false;
+    }
+    std::ifstream ifs(path_, std::ios::binary | std::ios::ate);
+    if (!ifs) {
+        return false;
+    }
+    std::string data(static_cast<size_t>(ifs.tellg()), '\0');
+    ifs.seekg(0);
+    if (!ifs.read(data.data(), data.size())) {
+        return false;
+    }
+    Reader r(data);
+    if (!r.match({magic, sizeof(magic)}) || r.u32() != format_version) {
+        return false;
+    }
+    if (!r.match(key_)) {
+        return false;
+    }
+    SurfaceTable t;
+    std::unordered_map<std::string, std::vector<int>> a;
+    int v = r.i32();
+    for (size_t i = 0, n = r.count(28); i < n && r.ok(); i++) {
+        SurfaceEntry s;
+        s.id = r.i32();
+        s.element = readRange(r);
+        s.animation = readRange(r);
+        s.collision = readRange(r);
+        t.surfaces_.push_back(s);
+    }
+    for (size_t i = 0, n = r.count(16); i < n && r.ok(); i++) {
+        Element e;
+        e.method = toEnum<Method>(r.i32(), static_cast<int>(Method::ParallelStop));
+        e.x = r.i32();
+        e.y = r.i32();
+        e.image = ImagePath::intern(r.str());
+        e.rehash();
+        t.elements_.push_back(std::move(e));
+    }
+    for (size_t i = 0, n = r.count(28); i < n && r.ok(); i++) {
+        AnimationEntry e = {};
+        e.id = r.i32();
+        e.interval = IntervalSet::fromBits(r.u32());
+        e.interval_factor = r.i32();
+        e.pattern = readRange(r);
+        if (r.u32()) {
+            e.exclusive = r.ints();
+        }
+        e.background = r.u32();
+        e.shared_index = r.u32();
+        t.animations_.push_back(std::move(e));
+    }
+    for (size_t i = 0, n = r.count(28); i < n && r.ok(); i++) {
+        Pattern p = {};
+        p.method = toEnum<Method>(r.i32(), static_cast<int>(Method::ParallelStop));
+        p.id = r.i32();
+        p.wait_min = r.i32();
+        p.wait_max = r.i32();
+        p.x = r.i32();
+        p.y = r.i32();
+        p.ids = r.ints();
+        t.patterns_.push_back(std::move(p));
+    }
+    for (size_t i = 0, n = r.count(16); i < n && r.ok(); i++) {
+        Collision c;
+        c.factor = r.i32();
+        c.type = toEnum<CollisionType>(r.i32(), static_cast<int>(CollisionType::Region));
+        c.id = r.str();
+        c.point = r.ints();
+        t.collisions_.push_back(std::move(c));
+    }
+    for (size_t i = 0, n = r.count(8); i < n && r.ok(); i++) {
+        auto key = r.str();
+        a[key] = r.ints();
+    }
+    if (!r.ok() || !r.end() || !t.valid()) {
+        Logger::log("Surfaces: broken cache ", path_);
+        return false;
+    }
+    version = v;
+    table = std::move(t);
+    alias = std::move(a);
+    return true;
+}
+
+void SurfacesCache::save(int version, const SurfaceTable &table, const std::unordered_map<std::string, std::vector<int>> &alias) const {
+    if (path_.empty()) {
+        return;
+    }
+    std::string data;
+    Writer w(data);
+    data.append(magic, sizeof(magic));
+    w.u32(format_version);
+    data.append(key_);
+    w.i32(version);
+    // 各配列をそのまま並べる
+    w.u32(table.surfaces_.size());
+    for (auto &s : table.surfaces_) {
+        w.i32(s.id);
+        writeRange(w, s.element);
+        writeRange(w, s.animation);
+        writeRange(w, s.collision);
+    }
+    w.u32(table.elements_.size());
+    for (auto &e : table.elements_) {
+        w.i32(static_cast<int>(e.method));
+        w.i32(e.x);
+        w.i32(e.y);
+        w.str(ImagePath::get(e.image).string());
+    }
+    w.u32(table.animations_.size());
+    for (auto &a : table.animations_) {
+        w.i32(a.id);
+        w.u32(a.interval.bits());
+        w.i32(a.interval_factor);
+        writeRange(w, a.pattern);
+        w.u32(a.exclusive.has_value());
+        if (a.exclusive) {
+            w.ints(a.exclusive.value());
+        }
+        w.u32(a.background);
+        w.u32(a.shared_index);
+    }
+    w.u32(table.patterns_.size());
+    for (auto &p : table.patterns_) {
+        w.i32(static_cast<int>(p.method));
+        w.i32(p.id);
+        w.i32(p.wait_min);
+        w.i32(p.wait_max);
+        w.i32(p.x);
+        w.i32(p.y);
+        w.ints(p.ids);
+    }
+    w.u32(table.collisions_.size());
+    for (auto &c : table.collisions_) {
+        w.i32(c.factor);
+        w.i32(static_cast<int>(c.type));
+        w.str(c.id);
+        w.ints(c.point);
+    }
+    w.u32(alias.size());
+    for (auto &[key, list] : alias) {
+        w.str(key);
+        w.ints(list);
+    }
+    // 書き込み途中のファイルを読まないように別名で書いてから置き換える
+    auto tmp = path_;
+    tmp += ".tmp";
+    {
+        std::ofstream ofs(tmp, std::ios::binary | std::ios::trunc);
+        if (!ofs.write(data.c_str(), data.size())) {
+            return;
+        }
+    }
+    std::error_code ec;
+    std::filesystem::rename(tmp, path_, ec);
+    if (ec) {
+        std::filesystem::remove(tmp, ec);
+    }
+}
@@ -0,0 +1,25 @@
+#ifndef SURFACES_CACHE_H_
+#define SURFACES_CACHE_H_
+
+#include <filesystem>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "surface_table.h"
+
+// surfaces*.txtを解析した結果をバイナリで保存しておき
+// 次回以降の起動ではそちらを読み込む
+// 元ファイルの名前、サイズ、更新時刻が変わった場合は使わない
+class SurfacesCache {
+    private:
+        std::filesystem::path path_;
+        std::string key_;
+    public:
+        SurfacesCache(const std::filesystem::path &ayu_dir, const std::vector<std::filesystem::path> &sources);
+        ~SurfacesCache() {}
+        bool load(int &version, SurfaceTable &table, std::unordered_map<std::string, std::vector<int>> &alias) const;
+        void save(int version, const SurfaceTable &table, const std::unordered_map<std::string, std::vector<int>> &alias) const;
+};
+
+#endif // SURFACES_CACHE_H_
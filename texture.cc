@@ -2,9 +2,32 @@
 
 #include <iostream>
 
+#include "image_path.h"
 #include "logger.h"
 
-Texture::Texture(Rect r, const std::vector<Rect> &region) : r_(r), valid_(true), region_(region), is_upconverted_(false) {
+Texture::Texture(Rect r, const std::vector<Rect> &region) : id_(0), r_(r), valid_(true), region_(region), is_upconverted_(false), atlas_(nullptr), pool_(nullptr) {
+    create();
+}
+
+// 空いていればアトラス上に確保し、無理なら単独のテクスチャにする
+Texture::Texture(TextureAtlas &atlas, Rect r, const std::vector<Rect> &region)
+    : id_(0), r_(r), valid_(true), region_(region), is_upconverted_(false),
+    atlas_(&atlas), atlas_region_(atlas.allocate(r.width, r.height)), pool_(nullptr) {
+    if (atlas_region_) {
+        id_ = atlas_region_->id;
+        return;
+    }
+    create();
+}
+
+// 左下の(r.width, r.height)だけを使う
+Texture::Texture(TexturePool &pool, Rect r, const std::vector<Rect> &region)
+    : r_(r), valid_(true), region_(region), is_upconverted_(false),
+    atlas_(nullptr), pool_(&pool), pooled_(pool.acquire(r.width, r.height)) {
+    id_ = pooled_->id;
+}
+
+void Texture::create() {
     glGenTextures(1, &id_);
     assert(glGetError() == GL_NO_ERROR);
     glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
@@ -19,35 +42,17 @@ Texture::Texture(Rect r, const std::vector<Rect> &region) : r_(r), valid_(true),
     assert(glGetError() == GL_NO_ERROR);
 }
 
-Texture::Texture(std::unique_ptr<ImageCache> &cache, const Element &e, const bool use_self_alpha) : valid_(true), is_upconverted_(false) {
-    Logger::log("filename: ", e.filename.string());
-    auto &info = cache->get(e.filename);
+Texture::Texture(std::unique_ptr<ImageCache> &cache, const Element &e, const bool use_self_alpha) : id_(0), valid_(true), is_upconverted_(false), atlas_(nullptr), pool_(nullptr) {
+    Logger::log("filename: ", ImagePath::get(e.image).string());
+    auto &info = cache->get(e.image);
     if (!info) {
         valid_ = false;
         return;
     }
     r_ = { e.x, e.y, info->width(), info->height() };
-    const unsigned char *p = info->get().data();
-    for (int y = 0; y < info->height(); y++) {
-        int begin = -1;
-        for (int x = 0; x < info->width(); x++) {
-            int index = 4 * (y * info->width() + x);
-            int alpha = p[index + 3];
-            if (alpha) {
-                if (begin == -1) {
-                    begin = x;
-                }
-            }
-            else {
-                if (begin != -1) {
-                    region_.push_back({r_.x + begin, r_.y + y, x - begin, 1});
-                    begin = -1;
-                }
-            }
-        }
-        if (begin != -1) {
-            region_.push_back({r_.x + begin, r_.y + y, info->width() - begin, 1});
-        }
+    region_.reserve(info->region().size());
+    for (auto &r : info->region()) {
+        region_.push_back({r_.x + r.x, r_.y + r.y, r.width, r.height});
     }
     glGenTextures(1, &id_);
     assert(glGetError() == GL_NO_ERROR);
@@ -3,6 +3,7 @@
 
 #include <cassert>
 #include <memory>
+#include <optional>
 #include <string>
 #include <unordered_map>
 
@@ -10,6 +11,8 @@
 #include "image_cache.h"
 #include "misc.h"
 #include "surface.h"
+#include "texture_atlas.h"
+#include "texture_pool.h"
 
 class Texture {
     private:
@@ -18,17 +21,70 @@ class Texture {
         bool valid_;
         std::vector<Rect> region_;
         bool is_upconverted_;
+        // アトラス上に置いた場合のみ
+        TextureAtlas *atlas_;
+        std::optional<AtlasRegion> atlas_region_;
+        // プールから借りた場合のみ
+        TexturePool *pool_;
+        std::optional<PooledTexture> pooled_;
+        void create();
     public:
-        Texture() : valid_(false), is_upconverted_(true) {}
+        Texture() : id_(0), valid_(false), is_upconverted_(true), atlas_(nullptr), pool_(nullptr) {}
+        // 中身の無いテクスチャ
+        // upconvertedがfalseなら後で作り直してもらう
+        Texture(bool upconverted) : id_(0), valid_(false), is_upconverted_(upconverted), atlas_(nullptr), pool_(nullptr) {}
         Texture(Rect r, const std::vector<Rect> &region);
+        Texture(TextureAtlas &atlas, Rect r, const std::vector<Rect> &region);
+        Texture(TexturePool &pool, Rect r, const std::vector<Rect> &region);
         Texture(std::unique_ptr<ImageCache> &cache, const Element &e, const bool use_self_alpha);
         ~Texture() {
-            glDeleteTextures(1, &id_);
+            if (atlas_region_) {
+                atlas_->release(atlas_region_.value());
+            }
+            else if (pooled_) {
+                pool_->release(pooled_.value());
+            }
+            else {
+                glDeleteTextures(1, &id_);
+            }
         }
         GLuint id() const {
             assert(valid_);
             return id_;
         }
+        // テクスチャ内でこのテクスチャが占める位置
+        Offset origin() const {
+            if (atlas_region_) {
+                return {atlas_region_->x, atlas_region_->y};
+            }
+            return {0, 0};
+        }
+        UVRect uv() const {
+            if (atlas_region_) {
+                return atlas_region_->uv;
+            }
+            if (pooled_) {
+                return {0, 0, static_cast<float>(r_.width) / pooled_->width, static_cast<float>(r_.height) / pooled_->height};
+            }
+            return {0, 0, 1, 1};
+        }
+        // GPU上で占める大きさ
+        size_t bytes() const {
+            if (!valid_) {
+                return 0;
+            }
+            if (atlas_region_) {
+                return static_cast<size_t>(atlas_region_->width) * atlas_region_->height * 4;
+            }
+            if (pooled_) {
+                return static_cast<size_t>(pooled_->width) * pooled_->height * 4;
+            }
+            return static_cast<size_t>(r_.width) * r_.height * 4;
+        }
+        // アトラス上にあれば、大きさはアトラスの方で数える
+        bool inAtlas() const {
+            return atlas_region_.has_value();
+        }
         Rect rect() const {
             assert(valid_);
             return r_;
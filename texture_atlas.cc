@@ -0,0 +1,111 @@
+#include "texture_atlas.h"
+
+#include <algorithm>
+#include <cassert>
+
+#include "logger.h"
+
+namespace {
+    // 1ページの最大の大きさ
+    const int page_size = 2048;
+    // NEARESTでも隣の領域を拾わないように空ける隙間
+    const int padding = 1;
+    // これより大きい画像はアトラスに置かない
+    const int max_area = page_size * page_size / 4;
+}
+
+TextureAtlas::TextureAtlas() {
+    GLint max_size = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_size);
+    assert(glGetError() == GL_NO_ERROR);
+    size_ = std::min(page_size, static_cast<int>(max_size));
+}
+
+TextureAtlas::~TextureAtlas() {
+    for (auto &page : pages_) {
+        glDeleteTextures(1, &page.id);
+    }
+}
+
+void TextureAtlas::addPage() {
+    Page page = {0, 0, 0, 0, 0};
+    glGenTextures(1, &page.id);
+    assert(glGetError() == GL_NO_ERROR);
+    glBindTexture(GL_TEXTURE_2D, page.id);
+    assert(glGetError() == GL_NO_ERROR);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, size_, size_, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    assert(glGetError() == GL_NO_ERROR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    assert(glGetError() == GL_NO_ERROR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    assert(glGetError() == GL_NO_ERROR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    assert(glGetError() == GL_NO_ERROR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    assert(glGetError() == GL_NO_ERROR);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    assert(glGetError() == GL_NO_ERROR);
+    pages_.push_back(page);
+    Logger::log("atlas: page ", pages_.size());
+}
+
+bool TextureAtlas::allocate(Page &page, int w, int h, int &x, int &y) {
+    // 今の棚に収まらなければ次の棚へ
+    if (page.cursor_x + w > size_ || h > page.shelf_height) {
+        int next_y = page.shelf_y + page.shelf_height;
+        // 今の棚が空で高さだけ足りない場合はそのまま広げる
+        if (page.cursor_x == 0) {
+            next_y = page.shelf_y;
+        }
+        if (next_y + h > size_) {
+            return false;
+        }
+        if (page.cursor_x != 0 || h > page.shelf_height) {
+            page.shelf_y = next_y;
+            page.shelf_height = h;
+            page.cursor_x = 0;
+        }
+    }
+    x = page.cursor_x;
+    y = page.shelf_y;
+    page.cursor_x += w;
+    page.live++;
+    return true;
+}
+
+std::optional<AtlasRegion> TextureAtlas::allocate(int width, int height) {
+    if (width <= 0 || height <= 0 || width * height > max_area) {
+        return std::nullopt;
+    }
+    int w = width + padding;
+    int h = height + padding;
+    if (w > size_ || h > size_) {
+        return std::nullopt;
+    }
+    int x, y;
+    for (size_t i = 0; i <= pages_.size(); i++) {
+        if (i == pages_.size()) {
+            addPage();
+        }
+        auto &page = pages_[i];
+        if (allocate(page, w, h, x, y)) {
+            float s = size_;
+            return AtlasRegion{page.id, static_cast<int>(i), x, y, width, height,
+                {x / s, y / s, width / s, height / s}};
+        }
+    }
+    return std::nullopt;
+}
+
+void TextureAtlas::release(const AtlasRegion &region) {
+    assert(static_cast<size_t>(region.page) < pages_.size());
+    auto &page = pages_[region.page];
+    assert(page.live > 0);
+    page.live--;
+    // 全て空いたらページを最初から使い直す
+    if (page.live == 0) {
+        page.shelf_y = 0;
+        page.shelf_height = 0;
+        page.cursor_x = 0;
+    }
+}
@@ -0,0 +1,43 @@
+#ifndef TEXTURE_ATLAS_H_
+#define TEXTURE_ATLAS_H_
+
+#include <optional>
+#include <vector>
+
+#include "glad/glad.h"
+#include "misc.h"
+
+// アトラス上に確保した領域
+struct AtlasRegion {
+    GLuint id;
+    int page;
+    int x, y, width, height;
+    UVRect uv;
+};
+
+// 小さなテクスチャを大きなテクスチャにまとめて確保する
+// ページ毎に棚(shelf)を積んでいくだけの単純な詰め方で
+// 解放はページ内の全ての領域が解放された時にまとめて行う
+class TextureAtlas {
+    private:
+        struct Page {
+            GLuint id;
+            int shelf_y, shelf_height, cursor_x;
+            int live;
+        };
+        int size_;
+        std::vector<Page> pages_;
+        bool allocate(Page &page, int w, int h, int &x, int &y);
+        void addPage();
+    public:
+        TextureAtlas();
+        ~TextureAtlas();
+        std::optional<AtlasRegion> allocate(int width, int height);
+        void release(const AtlasRegion &region);
+        // ページは解放しないので確保した全てのページの大きさ
+        size_t bytes() const {
+            return pages_.size() * size_ * size_ * 4;
+        }
+};
+
+#endif // TEXTURE_ATLAS_H_
@@ -20,11 +20,10 @@ namespace {
 
 class FrameBuffer {
     private:
+        TexturePool &pool_;
         GLuint id_;
     public:
-        FrameBuffer() {
-            glGenFramebuffers(1, &id_);
-            assert(glGetError() == GL_NO_ERROR);
+        FrameBuffer(TexturePool &pool) : pool_(pool), id_(pool.acquireFramebuffer()) {
             bind();
         }
         void bind() {
@@ -34,151 +33,265 @@ class FrameBuffer {
         ~FrameBuffer() {
             glBindFramebuffer(GL_FRAMEBUFFER, 0);
             assert(glGetError() == GL_NO_ERROR);
-            glDeleteFramebuffers(1, &id_);
-            assert(glGetError() == GL_NO_ERROR);
+            pool_.releaseFramebuffer(id_);
         }
 };
 
+// 読み込み済みの画像から要素のテクスチャを作る
+std::unique_ptr<Texture> TextureCache::create(std::unique_ptr<ImageCache> &cache, const Element &e, const std::unique_ptr<Program> &program, const bool use_self_alpha) {
+    auto t = std::make_unique<Texture>(cache, e, use_self_alpha);
+    if (!*t) {
+        Logger::log("invalid texture");
+        return std::make_unique<Texture>();
+    }
+    Logger::log("t1     : ", t->isUpconverted());
+    if (!atlas_) {
+        atlas_ = std::make_unique<TextureAtlas>();
+    }
+    FrameBuffer fb(pool_);
+    auto texture = std::make_unique<Texture>(*atlas_, t->rect(), t->region());
+    glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, texture->id(), 0);
+    assert(glGetError() == GL_NO_ERROR);
+    GLenum buffers[1] = { GL_COLOR_ATTACHMENT0 };
+    glDrawBuffers(1, buffers);
+    assert(glGetError() == GL_NO_ERROR);
+    fb.bind();
+    program->use(view);
+    auto [x, y, w, h] = t->rect();
+    // アトラス上の場合は割り当てられた領域の外に描かないようにする
+    auto origin = texture->origin();
+    glEnable(GL_SCISSOR_TEST);
+    assert(glGetError() == GL_NO_ERROR);
+    glScissor(origin.x, origin.y, w, h);
+    assert(glGetError() == GL_NO_ERROR);
+    glClearColor(0.0, 0.0, 0.0, 0.0);
+    assert(glGetError() == GL_NO_ERROR);
+    glClear(GL_COLOR_BUFFER_BIT);
+    assert(glGetError() == GL_NO_ERROR);
+    // テクスチャは上下反転で保持されているので
+    // 素直に引数を取ってよい(左上原点とした座標変換はいらない)
+    glViewport(origin.x + x, origin.y + y, w, h);
+    assert(glGetError() == GL_NO_ERROR);
+    program->set(t->id());
+    // methodは合成する時に適用するので、ここでは前乗算するだけ
+    glBlendFuncSeparate(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA, GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+    assert(glGetError() == GL_NO_ERROR);
+    glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+    assert(glGetError() == GL_NO_ERROR);
+    glDisable(GL_SCISSOR_TEST);
+    assert(glGetError() == GL_NO_ERROR);
+    assert(glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE);
+    Logger::log("t2     : ", t->isUpconverted());
+    if (t->isUpconverted()) {
+        texture->upconverted();
+    }
+    return texture;
+}
+
 std::unique_ptr<Texture> &TextureCache::get(std::unique_ptr<ImageCache> &cache, const Element &e, const std::unique_ptr<Program> &program, const bool use_self_alpha, bool &regenerate) {
+    // 読み込みが終わるまでは何も描かず、終わったら作り直してもらう
+    if (!cache->ready(e.image)) {
+        cache->request(e.image);
+        return pending_;
+    }
     bool load_required = true;
     if (elements_.contains(e)) {
         auto &t = elements_.at(e);
-        auto &info = cache->get(e.filename);
-        Logger::log("texture: ", t->isUpconverted());
-        Logger::log("info   : ", info->isUpconverted());
-        if (t->isUpconverted() == info->isUpconverted()) {
+        auto &info = cache->get(e.image);
+        if (!info) {
+            load_required = false;
+        }
+        else if (t->isUpconverted() == info->isUpconverted()) {
             load_required = false;
         }
         else {
             regenerate = true;
         }
     }
+    else {
+        // 読み込み中だったものが使えるようになった
+        regenerate = true;
+        // 先読みしてあればそれを使う
+        auto it = prefetched_.find(e);
+        if (it != prefetched_.end()) {
+            auto &info = cache->get(e.image);
+            if (!info || it->second->isUpconverted() == info->isUpconverted()) {
+                elements_[e] = std::move(it->second);
+                load_required = false;
+            }
+            prefetched_.erase(it);
+        }
+    }
     if (load_required) {
-        auto t = std::make_unique<Texture>(cache, e, use_self_alpha);
-        if (!*t) {
-            Logger::log("invalid texture");
-            elements_[e] = std::make_unique<Texture>();
+        elements_[e] = create(cache, e, program, use_self_alpha);
+    }
+    Logger::log("return texture: ", elements_.at(e)->isUpconverted());
+    return elements_.at(e);
+}
+
+// 描くより前に要素のテクスチャを作っておく
+// 画像の読み込みが終わっていなければfalse
+bool TextureCache::prefetch(std::unique_ptr<ImageCache> &cache, const Element &e, const std::unique_ptr<Program> &program, const bool use_self_alpha) {
+    if (elements_.contains(e) || prefetched_.contains(e)) {
+        return true;
+    }
+    if (!cache->ready(e.image)) {
+        cache->request(e.image);
+        return false;
+    }
+    prefetched_[e] = create(cache, e, program, use_self_alpha);
+    return true;
+}
+
+// keyを描くのに要る画像が全て読み込み済みかどうか
+// 読み込みが終わっていないものは読み込みを依頼しておく
+bool TextureCache::ready(std::unique_ptr<ImageCache> &cache, const std::vector<RenderInfo> &key) const {
+    bool ret = true;
+    for (auto &info : key) {
+        if (std::holds_alternative<Element>(info)) {
+            auto &e = std::get<Element>(info);
+            if (!cache->ready(e.image)) {
+                cache->request(e.image);
+                ret = false;
+            }
         }
-        else {
-            Logger::log("t1     : ", t->isUpconverted());
-            FrameBuffer fb;
-            auto texture = std::make_unique<Texture>(t->rect(), t->region());
-            glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, texture->id(), 0);
-            assert(glGetError() == GL_NO_ERROR);
-            GLenum buffers[1] = { GL_COLOR_ATTACHMENT0 };
-            glDrawBuffers(1, buffers);
-            assert(glGetError() == GL_NO_ERROR);
-            fb.bind();
-            program->use(view);
-            glClearColor(0.0, 0.0, 0.0, 0.0);
-            assert(glGetError() == GL_NO_ERROR);
-            glClear(GL_COLOR_BUFFER_BIT);
-            assert(glGetError() == GL_NO_ERROR);
+        else if (!ready(cache, std::get<ElementWithChildren>(info).children)) {
+            ret = false;
+        }
+    }
+    return ret;
+}
+
+// 子を1つだけ持ち、何も無い所に重ねると元の色のままになるmethodであれば
+// 中間テクスチャを作らずに子の矩形を直接描いても結果は変わらない
+bool TextureCache::flattenable(const ElementWithChildren &e) {
+    if (e.children.size() != 1) {
+        return false;
+    }
+    Method method = std::visit([](const auto &child) {
+        return child.method;
+    }, e.children.front());
+    switch (method) {
+        case Method::OverlayFast:
+        case Method::OverlayMultiply:
+        case Method::Reduce:
+        case Method::Asis:
+            return false;
+        default:
+            return true;
+    }
+}
+
+void TextureCache::collect(std::unique_ptr<ImageCache> &cache, const std::vector<RenderInfo> &key, const std::unique_ptr<Program> &program, const bool use_self_alpha, Layer &layer) {
+    bool _ = false;
+    auto extend = [&layer](const Rect &rect, const std::vector<Rect> &region) {
+        auto [x, y, w, h] = rect;
+        layer.r.x = std::min(layer.r.x, x);
+        layer.r.y = std::min(layer.r.y, y);
+        layer.r.width = std::max(layer.r.width, x + w);
+        layer.r.height = std::max(layer.r.height, y + h);
+        layer.region.reserve(layer.region.size() + region.size());
+        std::copy(region.begin(), region.end(), std::back_inserter(layer.region));
+    };
+    for (auto &info : key) {
+        if (std::holds_alternative<Element>(info)) {
+            auto &e = std::get<Element>(info);
+            auto &t = get(cache, e, program, use_self_alpha, _);
+            layer.upconverted = layer.upconverted && t->isUpconverted();
+            if (*t) {
+                extend(t->rect(), t->region());
+                layer.quads.push_back({t->id(), t->uv(), t->rect(), e.method});
+            }
+            continue;
+        }
+        auto &e = std::get<ElementWithChildren>(info);
+        if (flattenable(e)) {
+            Layer sub = {{inf, inf, 0, 0}, {}, {}, true};
+            collect(cache, e.children, program, use_self_alpha, sub);
+            layer.upconverted = layer.upconverted && sub.upconverted;
+            if (sub.region.empty()) {
+                continue;
+            }
+            extend(sub.r, sub.region);
+            // 中間テクスチャは(0, 0)-(r.width, r.height)の大きさで
+            // (e.x + r.x, e.y + r.y)に等倍で描かれるので
+            // その範囲で切り取ってから移動する
+            Offset shift = {e.x + sub.r.x, e.y + sub.r.y};
+            for (auto &q : sub.quads) {
+                int x0 = std::max(q.dst.x, 0), y0 = std::max(q.dst.y, 0);
+                int x1 = std::min(q.dst.x + q.dst.width, sub.r.width);
+                int y1 = std::min(q.dst.y + q.dst.height, sub.r.height);
+                if (x1 <= x0 || y1 <= y0) {
+                    continue;
+                }
+                UVRect uv = q.uv;
+                uv.x += q.uv.width * (x0 - q.dst.x) / q.dst.width;
+                uv.y += q.uv.height * (y0 - q.dst.y) / q.dst.height;
+                uv.width = q.uv.width * (x1 - x0) / q.dst.width;
+                uv.height = q.uv.height * (y1 - y0) / q.dst.height;
+                layer.quads.push_back({q.texture, uv, {shift.x + x0, shift.y + y0, x1 - x0, y1 - y0}, e.method});
+            }
+            continue;
+        }
+        if (e.children.size() == 0) {
+            continue;
+        }
+        auto &t = get(cache, e.children, program, use_self_alpha, _);
+        layer.upconverted = layer.upconverted && t->isUpconverted();
+        if (*t) {
+            extend(t->rect(), t->region());
             auto [x, y, w, h] = t->rect();
-            // テクスチャは上下反転で保持されているので
-            // 素直に引数を取ってよい(左上原点とした座標変換はいらない)
-            glViewport(x, y, w, h);
-            assert(glGetError() == GL_NO_ERROR);
-            program->set(t->id());
-            switch (e.method) {
-                case Method::Base:
-                case Method::Add:
-                case Method::Overlay:
-                    glBlendFuncSeparate(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA, GL_ONE, GL_ONE);
-                    break;
-                case Method::OverlayFast:
-                    glBlendFuncSeparate(GL_DST_ALPHA, GL_ONE_MINUS_SRC_ALPHA, GL_ONE, GL_ONE);
-                    break;
-                case Method::OverlayMultiply:
-                    // FIXME
-                    glBlendFuncSeparate(GL_ZERO, GL_SRC_COLOR, GL_ONE, GL_ONE);
-                    break;
-                case Method::Replace:
-                    glBlendFuncSeparate(GL_SRC_ALPHA, GL_ZERO, GL_ONE, GL_ONE);
-                    break;
-                case Method::Interpolate:
-                    glBlendFuncSeparate(GL_ONE_MINUS_DST_ALPHA, GL_ONE_MINUS_SRC_ALPHA, GL_ONE, GL_ONE);
-                    break;
-                case Method::Reduce:
-                    // FIXME
-                    glBlendFuncSeparate(GL_ZERO, GL_SRC_ALPHA, GL_ZERO, GL_ONE);
-                    break;
-                default:
-                    glBlendFuncSeparate(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA, GL_ONE, GL_ONE);
-                    break;
+            // patternの場合のoffsetを考慮。
+            layer.quads.push_back({t->id(), t->uv(), {e.x + x, e.y + y, w, h}, e.method});
+        }
+    }
+}
+
+// 構成するテクスチャが作り直されたかどうか
+bool TextureCache::refresh(std::unique_ptr<ImageCache> &cache, const std::vector<RenderInfo> &key, const std::unique_ptr<Program> &program, const bool use_self_alpha) {
+    for (auto &info : key) {
+        bool generated = false;
+        if (std::holds_alternative<Element>(info)) {
+            get(cache, std::get<Element>(info), program, use_self_alpha, generated);
+        }
+        else {
+            auto &e = std::get<ElementWithChildren>(info);
+            if (flattenable(e)) {
+                generated = refresh(cache, e.children, program, use_self_alpha);
             }
-            glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
-            assert(glGetError() == GL_NO_ERROR);
-            assert(glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE);
-            Logger::log("t2     : ", t->isUpconverted());
-            if (t->isUpconverted()) {
-                texture->upconverted();
+            else {
+                get(cache, e.children, program, use_self_alpha, generated);
             }
-            elements_[e] = std::move(texture);
+        }
+        if (generated) {
+            return true;
         }
     }
-    Logger::log("return texture: ", elements_.at(e)->isUpconverted());
-    return elements_.at(e);
+    return false;
 }
 
 std::unique_ptr<Texture> &TextureCache::get(std::unique_ptr<ImageCache> &cache, const std::vector<RenderInfo> &key, const std::unique_ptr<Program> &program, const bool use_self_alpha, bool &regenerate) {
     bool generate_required = true;
     if (cache_.contains(key)) {
-        auto &t = cache_.at(key);
+        auto &c = cache_.at(key);
+        touch(c);
         generate_required = false;
-        if (!t->isUpconverted()) {
-            for (auto &info : key) {
-                bool generated = false;
-                if (std::holds_alternative<Element>(info)) {
-                    get(cache, std::get<Element>(info), program, use_self_alpha, generated);
-                }
-                else {
-                    get(cache, std::get<ElementWithChildren>(info).children, program, use_self_alpha, generated);
-                }
-                if (generated) {
-                    generate_required = true;
-                    regenerate = true;
-                    break;
-                }
-            }
+        if (!c.texture->isUpconverted() && refresh(cache, key, program, use_self_alpha)) {
+            generate_required = true;
+            regenerate = true;
         }
     }
     if (generate_required) {
-        bool _ = false;
-        Rect r = {inf, inf, 0, 0};
-        std::vector<Rect> region_sum;
-        for (auto &info : key) {
-            if (std::holds_alternative<Element>(info)) {
-                auto &e = std::get<Element>(info);
-                auto &t = get(cache, e, program, use_self_alpha, _);
-                if (*t) {
-                    auto [x, y, w, h] = t->rect();
-                    r.x = std::min(r.x, x);
-                    r.y = std::min(r.y, y);
-                    r.width = std::max(r.width, x + w);
-                    r.height = std::max(r.height, y + h);
-                    auto &region = t->region();
-                    region_sum.reserve(region_sum.size() + region.size());
-                    std::copy(region.begin(), region.end(), std::back_inserter(region_sum));
-                }
-            }
-            else if (std::holds_alternative<ElementWithChildren>(info)) {
-                auto &e = std::get<ElementWithChildren>(info);
-                if (e.children.size() > 0) {
-                    auto &t = get(cache, e.children, program, use_self_alpha, _);
-                    if (*t) {
-                        auto [x, y, w, h] = t->rect();
-                        r.x = std::min(r.x, x);
-                        r.y = std::min(r.y, y);
-                        r.width = std::max(r.width, x + w);
-                        r.height = std::max(r.height, y + h);
-                        auto &region = t->region();
-                        region_sum.reserve(region_sum.size() + region.size());
-                        std::copy(region.begin(), region.end(), std::back_inserter(region_sum));
-                    }
-                }
-            }
-        }
+        misses_++;
+    }
+    else {
+        hits_++;
+    }
+    if (generate_required) {
+        std::unique_ptr<Texture> texture;
+        Layer layer = {{inf, inf, 0, 0}, {}, {}, true};
+        collect(cache, key, program, use_self_alpha, layer);
+        auto &region_sum = layer.region;
         if (region_sum.size() > 0) {
             std::vector<Rect> region;
             std::sort(region_sum.begin(), region_sum.end(), [](const auto &a, const auto &b) {
@@ -210,96 +323,229 @@ std::unique_ptr<Texture> &TextureCache::get(std::unique_ptr<ImageCache> &cache,
                     }
                 }
             }
-            bool is_upconverted = true;
-            FrameBuffer fb;
-            std::unique_ptr<Texture> texture = std::make_unique<Texture>(r, region);
+            auto r = layer.r;
+            FrameBuffer fb(pool_);
+            texture = std::make_unique<Texture>(pool_, r, region);
             glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, texture->id(), 0);
             assert(glGetError() == GL_NO_ERROR);
             GLenum buffers[1] = { GL_COLOR_ATTACHMENT0 };
             glDrawBuffers(1, buffers);
             assert(glGetError() == GL_NO_ERROR);
             fb.bind();
-            program->use(view);
             glClearColor(0.0, 0.0, 0.0, 0.0);
             assert(glGetError() == GL_NO_ERROR);
             glClear(GL_COLOR_BUFFER_BIT);
             assert(glGetError() == GL_NO_ERROR);
-            for (auto &info : key) {
-                std::unique_ptr<Texture> &t = (std::holds_alternative<Element>(info)) ? (get(cache, std::get<Element>(info), program, use_self_alpha, _)) : (get(cache, std::get<ElementWithChildren>(info).children, program, use_self_alpha, _));
-                if (*t) {
-                    is_upconverted = is_upconverted && t->isUpconverted();
-                    auto [x, y, w, h] = t->rect();
-                    // patternの場合のoffsetを考慮。
-                    Offset offset;
-                    if (std::holds_alternative<Element>(info)) {
-                        // すでにoffset考慮済みなので(0, 0)とする
-                        offset = {0, 0};
-                    }
-                    else {
-                        auto &e = std::get<ElementWithChildren>(info);
-                        offset = {e.x, e.y};
-                    }
-                    // テクスチャは上下反転で保持されているので
-                    // 素直に引数を取ってよい(左上原点とした座標変換はいらない)
-                    glViewport(offset.x + x, offset.y + y, w, h);
-                    assert(glGetError() == GL_NO_ERROR);
-                    program->set(t->id());
-                    std::visit([](const auto &e) {
-                        switch (e.method) {
-                            case Method::Base:
-                            case Method::Add:
-                            case Method::Overlay:
-                                glBlendFuncSeparate(GL_ONE, GL_ONE_MINUS_SRC_ALPHA, GL_ONE, GL_ONE);
-                                break;
-                            case Method::OverlayFast:
-                                glBlendFuncSeparate(GL_DST_ALPHA, GL_ONE_MINUS_SRC_ALPHA, GL_ONE, GL_ONE);
-                                break;
-                            case Method::OverlayMultiply:
-                                // FIXME
-                                glBlendFuncSeparate(GL_ZERO, GL_SRC_COLOR, GL_ONE, GL_ONE);
-                                break;
-                            case Method::Replace:
-                                glBlendFuncSeparate(GL_ONE, GL_ZERO, GL_ONE, GL_ONE);
-                                break;
-                            case Method::Interpolate:
-                                glBlendFuncSeparate(GL_ONE_MINUS_DST_ALPHA, GL_ONE_MINUS_SRC_ALPHA, GL_ONE, GL_ONE);
-                                break;
-                            case Method::Reduce:
-                                // FIXME
-                                glBlendFuncSeparate(GL_ZERO, GL_SRC_ALPHA, GL_ZERO, GL_ONE);
-                                break;
-                            default:
-                                glBlendFuncSeparate(GL_ONE, GL_ONE_MINUS_SRC_ALPHA, GL_ONE, GL_ONE);
-                                break;
-                        }
-                    }, info);
-                    glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
-                    assert(glGetError() == GL_NO_ERROR);
-                    assert(glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE);
-                }
-            }
-            if (is_upconverted) {
+            // 同じテクスチャ、同じ合成方法が続く所はまとめて1回で描く
+            program->draw(layer.quads, r.width, r.height);
+            assert(glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE);
+            if (layer.upconverted) {
                 Logger::log("texture upconverted!");
                 texture->upconverted();
             }
-            cache_[key] = std::move(texture);
-            Logger::log("upcon: ", cache_.at(key)->isUpconverted());
+            Logger::log("upcon: ", texture->isUpconverted());
         }
         else {
-            cache_[key] = std::make_unique<Texture>();
+            texture = std::make_unique<Texture>(layer.upconverted);
         }
+        auto [it, inserted] = cache_.try_emplace(key);
+        auto &c = it->second;
+        if (inserted) {
+            c.lru = lru_.insert(lru_.begin(), &it->first);
+        }
+        else {
+            bytes_ -= c.texture->bytes();
+            touch(c);
+        }
+        bytes_ += texture->bytes();
+        c.texture = std::move(texture);
     }
-    return cache_.at(key);
+    return cache_.at(key).texture;
 }
 
 std::unique_ptr<Texture> &TextureCache::get(std::unique_ptr<ImageCache> &cache, const std::vector<RenderInfo> &key, const std::unique_ptr<Program> &program, const bool use_self_alpha) {
     bool _ = false;
-    return get(cache, key, program, use_self_alpha, _);
+    auto &texture = get(cache, key, program, use_self_alpha, _);
+    // 合成の途中で捨てると描画待ちのテクスチャを上書きしかねないので
+    // 一番外側の呼び出しが終わってから減らす
+    trim();
+    return texture;
+}
+
+// collectと同じ方法で、keyを合成したテクスチャの矩形を求める
+// キャッシュに無いものがあれば分からないのでfalse
+bool TextureCache::extent(const std::vector<RenderInfo> &key, Rect &r, bool &visible) const {
+    auto extend = [&r, &visible](const Rect &rect) {
+        r.x = std::min(r.x, rect.x);
+        r.y = std::min(r.y, rect.y);
+        r.width = std::max(r.width, rect.x + rect.width);
+        r.height = std::max(r.height, rect.y + rect.height);
+        visible = true;
+    };
+    for (auto &info : key) {
+        if (std::holds_alternative<Element>(info)) {
+            auto it = elements_.find(std::get<Element>(info));
+            if (it == elements_.end()) {
+                return false;
+            }
+            if (*it->second) {
+                extend(it->second->rect());
+            }
+            continue;
+        }
+        auto &e = std::get<ElementWithChildren>(info);
+        if (flattenable(e)) {
+            Rect sub = {inf, inf, 0, 0};
+            bool sub_visible = false;
+            if (!extent(e.children, sub, sub_visible)) {
+                return false;
+            }
+            if (sub_visible) {
+                extend(sub);
+            }
+            continue;
+        }
+        if (e.children.size() == 0) {
+            continue;
+        }
+        auto it = cache_.find(e.children);
+        if (it == cache_.end()) {
+            return false;
+        }
+        if (*it->second.texture) {
+            extend(it->second.texture->rect());
+        }
+    }
+    return true;
+}
+
+// infoが親のテクスチャ上で描く範囲
+bool TextureCache::bounds(const RenderInfo &info, Rect &b) const {
+    b = {0, 0, 0, 0};
+    if (std::holds_alternative<Element>(info)) {
+        auto it = elements_.find(std::get<Element>(info));
+        if (it == elements_.end()) {
+            return false;
+        }
+        if (*it->second) {
+            b = it->second->rect();
+        }
+        return true;
+    }
+    auto &e = std::get<ElementWithChildren>(info);
+    if (flattenable(e)) {
+        Rect sub = {inf, inf, 0, 0};
+        bool visible = false;
+        if (!extent(e.children, sub, visible)) {
+            return false;
+        }
+        if (!visible) {
+            return true;
+        }
+        Rect u = {0, 0, 0, 0};
+        for (auto &child : e.children) {
+            Rect c;
+            if (!bounds(child, c)) {
+                return false;
+            }
+            u = u.unite(c);
+        }
+        // collectと同じく中間テクスチャの範囲で切り取ってから移動する
+        int x0 = std::max(u.x, 0), y0 = std::max(u.y, 0);
+        int x1 = std::min(u.x + u.width, sub.width), y1 = std::min(u.y + u.height, sub.height);
+        if (u.empty() || x1 <= x0 || y1 <= y0) {
+            return true;
+        }
+        b = {e.x + sub.x + x0, e.y + sub.y + y0, x1 - x0, y1 - y0};
+        return true;
+    }
+    if (e.children.size() == 0) {
+        return true;
+    }
+    auto it = cache_.find(e.children);
+    if (it == cache_.end()) {
+        return false;
+    }
+    if (*it->second.texture) {
+        auto [x, y, w, h] = it->second.texture->rect();
+        b = {e.x + x, e.y + y, w, h};
+    }
+    return true;
+}
+
+// 前回と今回で描き変わる範囲を合成後のテクスチャ上の座標で求める
+// 同じ位置にあるものだけを比べるので、数が変わった場合などは求めない
+bool TextureCache::damage(const std::vector<RenderInfo> &prev, const std::vector<RenderInfo> &current, Rect &d) const {
+    d = {0, 0, 0, 0};
+    if (prev.size() != current.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < current.size(); i++) {
+        if (prev[i] == current[i]) {
+            continue;
+        }
+        Rect before, after;
+        if (!bounds(prev[i], before) || !bounds(current[i], after)) {
+            return false;
+        }
+        d = d.unite(before).unite(after);
+    }
+    return true;
+}
+
+void TextureCache::touch(Composite &c) {
+    lru_.splice(lru_.begin(), lru_, c.lru);
+}
+
+// 要素のテクスチャとアトラスのページの大きさ
+size_t TextureCache::elementBytes() const {
+    size_t ret = (atlas_) ? (atlas_->bytes()) : (0);
+    for (auto &m : {&elements_, &prefetched_}) {
+        for (auto &[_, t] : *m) {
+            if (!t->inAtlas()) {
+                ret += t->bytes();
+            }
+        }
+    }
+    return ret;
+}
+
+// 要素、合成済みのもの、プールの未使用のものを合わせて上限に収める
+// 未使用のもの、古い合成済みのもの、先読みしたものの順に捨てる
+// 今返したものは先頭にあるので捨てない
+void TextureCache::trim() {
+    size_t elements = elementBytes();
+    while (true) {
+        size_t used = elements + bytes_;
+        pool_.trim((budget_ > used) ? (budget_ - used) : (0));
+        if (used <= budget_) {
+            break;
+        }
+        if (lru_.size() > 1) {
+            auto it = cache_.find(*lru_.back());
+            assert(it != cache_.end());
+            bytes_ -= it->second.texture->bytes();
+            lru_.pop_back();
+            // 捨てたテクスチャはプールに戻るので次で捨てる
+            cache_.erase(it);
+        }
+        else if (!prefetched_.empty()) {
+            prefetched_.clear();
+            elements = elementBytes();
+        }
+        else {
+            break;
+        }
+    }
+    Logger::log("texture cache: ", elements + bytes_ + pool_.idleBytes(), " bytes, hit: ", hits_, ", miss: ", misses_);
 }
 
 void TextureCache::clearCache(bool full) {
     if (full) {
         elements_.clear();
+        prefetched_.clear();
     }
     cache_.clear();
+    lru_.clear();
+    bytes_ = 0;
 }
@@ -1,6 +1,8 @@
 #ifndef TEXTURE_CACHE_H_
 #define TEXTURE_CACHE_H_
 
+#include <cstdint>
+#include <list>
 #include <memory>
 #include <unordered_map>
 #include <vector>
@@ -9,20 +11,69 @@
 #include "program.h"
 #include "seriko.h"
 #include "texture.h"
+#include "texture_atlas.h"
+#include "texture_pool.h"
+#include "util.h"
 
 class TextureCache {
     private:
+        // 以下のテクスチャより後に破棄する
+        TexturePool pool_;
+        // elements_の各テクスチャより後に破棄する
+        // コンテキストが出来てから作るので最初に使う時に作る
+        std::unique_ptr<TextureAtlas> atlas_;
         std::unordered_map<Element, std::unique_ptr<Texture>> elements_;
-        std::unordered_map<std::vector<RenderInfo>, std::unique_ptr<Texture>> cache_;
+        // 先読みで作ったもの
+        // 初めて使う時にelements_へ移し、合成済みのテクスチャを作り直させる
+        std::unordered_map<Element, std::unique_ptr<Texture>> prefetched_;
+        // 画像の読み込みが終わっていない間に返す
+        std::unique_ptr<Texture> pending_;
+        // 合成済みのテクスチャ
+        // 使った順に並べておき、上限を超えたら古いものから捨てる
+        struct Composite {
+            std::unique_ptr<Texture> texture;
+            std::list<const std::vector<RenderInfo> *>::iterator lru;
+        };
+        std::unordered_map<std::vector<RenderInfo>, Composite> cache_;
+        std::list<const std::vector<RenderInfo> *> lru_;
+        size_t bytes_;
+        size_t budget_;
+        uint64_t hits_;
+        uint64_t misses_;
+        bool extent(const std::vector<RenderInfo> &key, Rect &r, bool &visible) const;
+        bool bounds(const RenderInfo &info, Rect &b) const;
+        void touch(Composite &c);
+        size_t elementBytes() const;
+        void trim();
+        // 1枚のテクスチャにまとめて描くもの
+        struct Layer {
+            Rect r;
+            std::vector<Rect> region;
+            std::vector<Quad> quads;
+            bool upconverted;
+        };
+        std::unique_ptr<Texture> create(std::unique_ptr<ImageCache> &cache, const Element &e, const std::unique_ptr<Program> &program, const bool use_self_alpha);
+        static bool flattenable(const ElementWithChildren &e);
+        void collect(std::unique_ptr<ImageCache> &cache, const std::vector<RenderInfo> &key, const std::unique_ptr<Program> &program, const bool use_self_alpha, Layer &layer);
+        bool refresh(std::unique_ptr<ImageCache> &cache, const std::vector<RenderInfo> &key, const std::unique_ptr<Program> &program, const bool use_self_alpha);
     public:
-        TextureCache() {}
+        TextureCache() : pending_(std::make_unique<Texture>(false)), bytes_(0), budget_(util::textureCacheBudget()), hits_(0), misses_(0) {}
         ~TextureCache() {
             clearCache();
         }
         std::unique_ptr<Texture> &get(std::unique_ptr<ImageCache> &cache, const Element &e, const std::unique_ptr<Program> &program, const bool use_self_alpha, bool &regenerate);
         std::unique_ptr<Texture> &get(std::unique_ptr<ImageCache> &cache, const std::vector<RenderInfo> &key, const std::unique_ptr<Program> &program, const bool use_self_alpha, bool &regenerate);
         std::unique_ptr<Texture> &get(std::unique_ptr<ImageCache> &cache, const std::vector<RenderInfo> &key, const std::unique_ptr<Program> &program, const bool use_self_alpha);
+        bool prefetch(std::unique_ptr<ImageCache> &cache, const Element &e, const std::unique_ptr<Program> &program, const bool use_self_alpha);
+        bool ready(std::unique_ptr<ImageCache> &cache, const std::vector<RenderInfo> &key) const;
+        bool damage(const std::vector<RenderInfo> &prev, const std::vector<RenderInfo> &current, Rect &d) const;
         void clearCache(bool full = true);
+        uint64_t hits() const {
+            return hits_;
+        }
+        uint64_t misses() const {
+            return misses_;
+        }
 };
 
 #endif // TEXTURE_CACHE_H_
@@ -0,0 +1,118 @@
+#include "texture_pool.h"
+
+#include <algorithm>
+#include <cassert>
+
+#include "logger.h"
+
+namespace {
+    // 大きさはこの単位に切り上げる
+    const int bucket = 64;
+    // 1つの大きさにつき保持しておく未使用のテクスチャの数
+    const size_t max_idle = 4;
+    const size_t max_idle_framebuffers = 4;
+
+    int roundUp(int v) {
+        return (std::max(v, 1) + bucket - 1) / bucket * bucket;
+    }
+
+    size_t bytes(uint64_t key) {
+        return static_cast<size_t>(key >> 32) * static_cast<uint32_t>(key) * 4;
+    }
+}
+
+TexturePool::~TexturePool() {
+    for (auto id : framebuffers_) {
+        glDeleteFramebuffers(1, &id);
+    }
+    for (auto &[_, list] : textures_) {
+        glDeleteTextures(list.size(), list.data());
+    }
+}
+
+GLuint TexturePool::acquireFramebuffer() {
+    GLuint id;
+    if (framebuffers_.empty()) {
+        glGenFramebuffers(1, &id);
+        assert(glGetError() == GL_NO_ERROR);
+        return id;
+    }
+    id = framebuffers_.back();
+    framebuffers_.pop_back();
+    return id;
+}
+
+void TexturePool::releaseFramebuffer(GLuint id) {
+    if (framebuffers_.size() >= max_idle_framebuffers) {
+        glDeleteFramebuffers(1, &id);
+        assert(glGetError() == GL_NO_ERROR);
+        return;
+    }
+    framebuffers_.push_back(id);
+}
+
+PooledTexture TexturePool::acquire(int width, int height) {
+    PooledTexture texture = {0, roundUp(width), roundUp(height)};
+    auto k = key(texture.width, texture.height);
+    if (auto it = textures_.find(k); it != textures_.end()) {
+        auto &list = it->second;
+        texture.id = list.back();
+        list.pop_back();
+        if (list.empty()) {
+            textures_.erase(it);
+        }
+        idle_bytes_ -= bytes(k);
+        return texture;
+    }
+    glGenTextures(1, &texture.id);
+    assert(glGetError() == GL_NO_ERROR);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    assert(glGetError() == GL_NO_ERROR);
+    glBindTexture(GL_TEXTURE_2D, texture.id);
+    assert(glGetError() == GL_NO_ERROR);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, texture.width, texture.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    assert(glGetError() == GL_NO_ERROR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    assert(glGetError() == GL_NO_ERROR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    assert(glGetError() == GL_NO_ERROR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    assert(glGetError() == GL_NO_ERROR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    assert(glGetError() == GL_NO_ERROR);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    assert(glGetError() == GL_NO_ERROR);
+    Logger::log("pool: new texture ", texture.width, "x", texture.height);
+    return texture;
+}
+
+void TexturePool::release(const PooledTexture &texture) {
+    auto k = key(texture.width, texture.height);
+    auto &list = textures_[k];
+    if (list.size() >= max_idle) {
+        glDeleteTextures(1, &texture.id);
+        assert(glGetError() == GL_NO_ERROR);
+        return;
+    }
+    list.push_back(texture.id);
+    idle_bytes_ += bytes(k);
+}
+
+// 空になった大きさは消しておき、一度しか使わなかった大きさが溜まらないようにする
+void TexturePool::trim(size_t limit) {
+    for (auto it = textures_.begin(); it != textures_.end() && idle_bytes_ > limit;) {
+        auto &list = it->second;
+        while (!list.empty() && idle_bytes_ > limit) {
+            glDeleteTextures(1, &list.back());
+            assert(glGetError() == GL_NO_ERROR);
+            list.pop_back();
+            idle_bytes_ -= bytes(it->first);
+        }
+        if (list.empty()) {
+            it = textures_.erase(it);
+        }
+        else {
+            it++;
+        }
+    }
+}
@@ -0,0 +1,44 @@
+#ifndef TEXTURE_POOL_H_
+#define TEXTURE_POOL_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "glad/glad.h"
+
+// プールから借りたテクスチャ
+// 要求より大きい場合があるので実際の大きさも持つ
+struct PooledTexture {
+    GLuint id;
+    int width, height;
+};
+
+// 合成用のフレームバッファとテクスチャを使い回す
+// テクスチャは大きさを切り上げてまとめるので
+// 多少大きさが違っても同じものを使える
+class TexturePool {
+    private:
+        std::vector<GLuint> framebuffers_;
+        std::unordered_map<uint64_t, std::vector<GLuint>> textures_;
+        // 未使用のテクスチャの合計
+        size_t idle_bytes_;
+        static uint64_t key(int width, int height) {
+            return (static_cast<uint64_t>(width) << 32) | static_cast<uint32_t>(height);
+        }
+    public:
+        TexturePool() : idle_bytes_(0) {}
+        ~TexturePool();
+        GLuint acquireFramebuffer();
+        void releaseFramebuffer(GLuint id);
+        PooledTexture acquire(int width, int height);
+        void release(const PooledTexture &texture);
+        // 未使用のテクスチャをlimit以下になるまで捨てる
+        void trim(size_t limit);
+        size_t idleBytes() const {
+            return idle_bytes_;
+        }
+};
+
+#endif // TEXTURE_POOL_H_
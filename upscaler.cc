@@ -0,0 +1,154 @@
+#include "upscaler.h"
+
+#if defined(USE_ONNX)
+
+#include <algorithm>
+#include <cstring>
+
+#include "image_filter.h"
+#include "util.h"
+
+namespace {
+    // 入力画像でのタイルの大きさと、隣のタイルと最低限重ねる幅
+    const int tile_size = 128;
+    const int overlap = 8;
+
+    // 長さlenをt毎に区切った時の各タイルの始点
+    // 最後のタイルは端に揃え、全て同じ大きさにする
+    std::vector<int> positions(int len, int t) {
+        std::vector<int> ret;
+        int step = std::max(1, t - 2 * overlap);
+        for (int x = 0; ; x += step) {
+            if (x + t >= len) {
+                ret.push_back(len - t);
+                break;
+            }
+            ret.push_back(x);
+        }
+        return ret;
+    }
+
+    // 隣にタイルがある側は重なりの中で0から1へ上げる
+    float ramp(int u, int len, bool head, bool tail) {
+        const float r = 4 * overlap;
+        float w = 1.0f;
+        if (head) {
+            w = std::min(w, (u + 0.5f) / r);
+        }
+        if (tail) {
+            w = std::min(w, (len - u - 0.5f) / r);
+        }
+        return w;
+    }
+
+    Ort::SessionOptions options() {
+        Ort::SessionOptions options;
+        // 実行プロバイダは既定のCPUのまま
+        options.SetIntraOpNumThreads(util::onnxThreads());
+        options.SetInterOpNumThreads(1);
+        return options;
+    }
+}
+
+Upscaler::Upscaler(const std::filesystem::path &model_path)
+    : session_(env_, model_path.string().c_str(), options()),
+    memory_info_(Ort::MemoryInfo::CreateCpu(OrtDeviceAllocator, OrtMemTypeCPU)),
+    tile_w_(0), tile_h_(0), input_tensor_(nullptr), output_tensor_(nullptr) {
+}
+
+// モデルの入力は(4, 1, h, w)で、RGBAの各面を1チャンネルの画像として並べる
+void Upscaler::prepare(int w, int h) {
+    if (w == tile_w_ && h == tile_h_) {
+        return;
+    }
+    tile_w_ = w;
+    tile_h_ = h;
+    input_.resize(4 * w * h);
+    output_.resize(4 * (2 * w) * (2 * h));
+    std::array<int64_t, 4> input_shape = {4, 1, h, w};
+    std::array<int64_t, 4> output_shape = {4, 1, 2 * h, 2 * w};
+    input_tensor_ = Ort::Value::CreateTensor<float>(memory_info_, input_.data(), input_.size(), input_shape.data(), input_shape.size());
+    output_tensor_ = Ort::Value::CreateTensor<float>(memory_info_, output_.data(), output_.size(), output_shape.data(), output_shape.size());
+}
+
+// sum_の先頭からcount行を確定させてdestのrow行目から書き、残りを詰める
+void Upscaler::flush(std::vector<unsigned char> &dest, int width, int row, int count) {
+    size_t plane = weight_.size();
+    line_.resize(4 * width);
+    for (int y = 0; y < count; y++) {
+        for (int c = 0; c < 4; c++) {
+            const float *s = sum_.data() + c * plane + y * width;
+            const float *w = weight_.data() + y * width;
+            float *l = line_.data() + c * width;
+            for (int x = 0; x < width; x++) {
+                l[x] = s[x] / w[x];
+            }
+        }
+        const float *planes[4] = {line_.data(), line_.data() + width, line_.data() + 2 * width, line_.data() + 3 * width};
+        image_filter::fromPlanar(planes, dest.data() + 4 * static_cast<size_t>(row + y) * width, width);
+    }
+    size_t rest = plane - static_cast<size_t>(count) * width;
+    for (int c = 0; c < 4; c++) {
+        float *s = sum_.data() + c * plane;
+        std::memmove(s, s + count * width, rest * sizeof(float));
+        std::fill(s + rest, s + plane, 0.0f);
+    }
+    std::memmove(weight_.data(), weight_.data() + count * width, rest * sizeof(float));
+    std::fill(weight_.begin() + rest, weight_.end(), 0.0f);
+}
+
+void Upscaler::upscale(const std::vector<unsigned char> &src, int w, int h, std::vector<unsigned char> &dest) {
+    int tw = std::min(tile_size, w);
+    int th = std::min(tile_size, h);
+    prepare(tw, th);
+    auto xs = positions(w, tw);
+    auto ys = positions(h, th);
+    int width = 2 * w;
+    int rows = 2 * th;
+    dest.resize(4 * static_cast<size_t>(width) * (2 * h));
+    sum_.assign(4 * static_cast<size_t>(width) * rows, 0.0f);
+    weight_.assign(static_cast<size_t>(width) * rows, 0.0f);
+    size_t tile_plane = tw * th;
+    size_t out_plane = 4 * tile_plane;
+    float *planes[4] = {input_.data(), input_.data() + tile_plane, input_.data() + 2 * tile_plane, input_.data() + 3 * tile_plane};
+    const char *input_names[] = {"input"};
+    const char *output_names[] = {"output"};
+    Ort::RunOptions run_options;
+    std::vector<float> wx(2 * tw);
+    // sum_の先頭に当たる出力の行
+    int base = 0;
+    for (auto y0 : ys) {
+        // これより上の行には以降のタイルが重ならない
+        if (2 * y0 > base) {
+            flush(dest, width, base, 2 * y0 - base);
+            base = 2 * y0;
+        }
+        for (auto x0 : xs) {
+            for (int u = 0; u < 2 * tw; u++) {
+                wx[u] = ramp(u, 2 * tw, x0 > 0, x0 + tw < w);
+            }
+            for (int y = 0; y < th; y++) {
+                float *row[4] = {planes[0] + y * tw, planes[1] + y * tw, planes[2] + y * tw, planes[3] + y * tw};
+                image_filter::toPlanar(src.data() + 4 * (static_cast<size_t>(y0 + y) * w + x0), row, tw);
+            }
+            session_.Run(run_options, input_names, &input_tensor_, 1, output_names, &output_tensor_, 1);
+            for (int v = 0; v < 2 * th; v++) {
+                float wy = ramp(v, 2 * th, y0 > 0, y0 + th < h);
+                float *wr = weight_.data() + static_cast<size_t>(2 * y0 - base + v) * width + 2 * x0;
+                for (int u = 0; u < 2 * tw; u++) {
+                    wr[u] += wy * wx[u];
+                }
+                for (int c = 0; c < 4; c++) {
+                    const float *o = output_.data() + c * out_plane + v * (2 * tw);
+                    float *s = sum_.data() + c * weight_.size() + static_cast<size_t>(2 * y0 - base + v) * width + 2 * x0;
+                    for (int u = 0; u < 2 * tw; u++) {
+                        s[u] += o[u] * wy * wx[u];
+                    }
+                }
+            }
+        }
+    }
+    flush(dest, width, base, 2 * h - base);
+}
+
+#endif // USE_ONNX
@@ -0,0 +1,43 @@
+#ifndef UPSCALER_H_
+#define UPSCALER_H_
+
+#if defined(USE_ONNX)
+
+#include <array>
+#include <cstdint>
+#include <filesystem>
+#include <onnxruntime_cxx_api.h>
+#include <vector>
+
+// model.onnxで画像を2倍に拡大する(CPUのみ)
+// 大きな画像でもメモリを食わないように重なりを持たせたタイルに分けて推論し
+// 重なった部分は端ほど小さくなる重みで混ぜる
+// 1つのスレッドからだけ使う
+class Upscaler {
+    private:
+        Ort::Env env_;
+        Ort::Session session_;
+        Ort::MemoryInfo memory_info_;
+        // タイル1枚分の入出力(RGBAの各面を並べたもの)
+        // タイルの大きさが変わらない限り作り直さない
+        int tile_w_, tile_h_;
+        std::vector<float> input_;
+        std::vector<float> output_;
+        Ort::Value input_tensor_;
+        Ort::Value output_tensor_;
+        // 出力のうちタイル1行分の重み付きの和と重みの和
+        std::vector<float> sum_;
+        std::vector<float> weight_;
+        std::vector<float> line_;
+        void prepare(int w, int h);
+        void flush(std::vector<unsigned char> &dest, int width, int row, int count);
+    public:
+        Upscaler(const std::filesystem::path &model_path);
+        ~Upscaler() {}
+        // 失敗した場合はOrt::Exceptionを投げる
+        void upscale(const std::vector<unsigned char> &src, int w, int h, std::vector<unsigned char> &dest);
+};
+
+#endif // USE_ONNX
+
+#endif // UPSCALER_H_
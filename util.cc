@@ -1,8 +1,10 @@
 #include "util.h"
 
+#include <algorithm>
 #include <cassert>
 #include <cstdlib>
 #include <random>
+#include <thread>
 
 namespace {
     std::random_device rd;
@@ -44,4 +46,65 @@ namespace util {
     bool isCompatibleRendering() {
         return !!getenv("NINIX_ENABLE_MULTI_MONITOR");
     }
+
+    // Waylandでキャラクターの大きさのsubsurfaceに描く
+    bool useSubsurface() {
+        return isWayland() && !!getenv("AYU_WAYLAND_SUBSURFACE");
+    }
+
+    // AYU_TEXTURE_CACHE_MBで指定できる
+    size_t textureCacheBudget() {
+        size_t mb = 64;
+        if (auto p = getenv("AYU_TEXTURE_CACHE_MB"); p && *p) {
+            to_x(std::string_view(p), mb);
+        }
+        return mb * 1024 * 1024;
+    }
+
+    // AYU_ONNX_THREADSで指定できる
+    // 読み込みスレッドと分け合うので既定値はコア数の半分
+    int onnxThreads() {
+        int n = std::max(1u, std::thread::hardware_concurrency() / 2);
+        if (auto p = getenv("AYU_ONNX_THREADS"); p && *p) {
+            to_x(std::string_view(p), n);
+        }
+        return std::max(1, n);
+    }
+
+    // 解析結果などを保存しておくディレクトリ
+    // 作れなかった場合は空のパスを返す
+    std::filesystem::path cacheDir() {
+        std::filesystem::path dir;
+#if defined(_WIN32) || defined(WIN32)
+        if (auto p = getenv("LOCALAPPDATA")) {
+            dir = p;
+        }
+#else
+        if (auto p = getenv("XDG_CACHE_HOME"); p && *p) {
+            dir = p;
+        }
+        else if (auto p = getenv("HOME")) {
+            dir = std::filesystem::path(p) / ".cache";
+        }
+#endif // WIN32
+        if (dir.empty()) {
+            return dir;
+        }
+        dir /= "ayu_builtin";
+        std::error_code ec;
+        std::filesystem::create_directories(dir, ec);
+        if (ec) {
+            return {};
+        }
+        return dir;
+    }
+
+    uint64_t fnv1a(const void *data, size_t size, uint64_t hash) {
+        auto p = static_cast<const unsigned char *>(data);
+        for (size_t i = 0; i < size; i++) {
+            hash ^= p[i];
+            hash *= 0x100000001b3ULL;
+        }
+        return hash;
+    }
 }
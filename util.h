@@ -1,8 +1,13 @@
 #ifndef UTIL_H_
 #define UTIL_H_
 
+#include <charconv>
+#include <cstdint>
+#include <filesystem>
 #include <sstream>
 #include <string>
+#include <string_view>
+#include <type_traits>
 
 constexpr int BUFFER_SIZE = 1024;
 
@@ -13,6 +18,26 @@ namespace util {
         iss >> value;
     }
 
+    // 受信バッファを指したままの値を変換する
+    template<typename T>
+    void to_x(std::string_view s, T &value) {
+        if constexpr (std::is_integral_v<T>) {
+            while (!s.empty() && (s.front() == ' ' || s.front() == '\t')) {
+                s.remove_prefix(1);
+            }
+            if (s.starts_with('+')) {
+                s.remove_prefix(1);
+            }
+            // istringstreamと同じく失敗したら0にする
+            value = T{};
+            std::from_chars(s.data(), s.data() + s.size(), value);
+        }
+        else {
+            std::istringstream iss{std::string(s)};
+            iss >> value;
+        }
+    }
+
     template<typename T>
     std::string to_s(T value) {
         std::ostringstream oss;
@@ -27,6 +52,22 @@ namespace util {
 
     bool isWayland();
     bool isCompatibleRendering();
+    bool useSubsurface();
+
+    // 超解像に使うスレッド数
+    int onnxThreads();
+
+    std::filesystem::path cacheDir();
+
+    // 合成済みテクスチャに使うGPUメモリの上限(バイト)
+    size_t textureCacheBudget();
+
+    // boost::hash_combineの64bit版と同じ混ぜ方
+    inline void hashCombine(size_t &seed, size_t value) {
+        seed ^= value + 0x9e3779b97f4a7c15ULL + (seed << 12) + (seed >> 4);
+    }
+
+    uint64_t fnv1a(const void *data, size_t size, uint64_t hash = 0xcbf29ce484222325ULL);
 }
 
 #endif // UTIL_H_
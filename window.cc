@@ -14,6 +14,7 @@
 
 #if defined(USE_WAYLAND)
 #define GLFW_EXPOSE_NATIVE_WAYLAND
+#define GLFW_EXPOSE_NATIVE_EGL
 #define GLFW_NATIVE_INCLUDE_NONE
 #include <GLFW/glfw3native.h>
 #endif // USE_WAYLAND
@@ -25,6 +26,7 @@
 #endif // USE_X11
 
 #include "character.h"
+#include "image_path.h"
 #include "logger.h"
 #include "sstp.h"
 
@@ -34,13 +36,33 @@ namespace {
             glm::vec3(0, 0, 0),
             glm::vec3(0, 1, 0)
             );
+    // buffer ageとして取りうる値より多く覚えておく
+    const size_t max_damage_history = 4;
+
+#if defined(USE_WAYLAND)
+    bool hasExtension(const char *extensions, std::string_view name) {
+        if (extensions == nullptr) {
+            return false;
+        }
+        std::string_view list = extensions;
+        size_t pos = 0;
+        while ((pos = list.find(name, pos)) != std::string_view::npos) {
+            size_t end = pos + name.size();
+            if ((pos == 0 || list[pos - 1] == ' ') && (end == list.size() || list[end] == ' ')) {
+                return true;
+            }
+            pos = end;
+        }
+        return false;
+    }
+#endif // USE_WAYLAND
 }
 
 Window::Window(Character *parent, GLFWmonitor *monitor)
     : window_(nullptr), size_({0, 0}),
     position_({0, 0}), parent_(parent),
     cache_(std::make_unique<TextureCache>()), adjust_(false),
-    counter_(0), offset_({0, 0}) {
+    counter_(0), offset_({0, 0}), prev_rect_({0, 0, 0, 0}), prev_upconverted_(false) {
     glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
     assert(glfwGetError(nullptr) == GLFW_NO_ERROR);
     glfwWindowHint(GLFW_DECORATED, GLFW_FALSE);
@@ -119,6 +141,36 @@ Window::Window(Character *parent, GLFWmonitor *monitor)
     glfwSwapInterval(1);
     assert(glfwGetError(nullptr) == GLFW_NO_ERROR);
 
+#if defined(USE_WAYLAND)
+    // EGLで作られていれば前のバッファの内容と描き変えた範囲を使える
+    buffer_age_ = false;
+    swap_with_damage_ = nullptr;
+    EGLDisplay egl_display = glfwGetEGLDisplay();
+    if (egl_display != EGL_NO_DISPLAY && glfwGetEGLSurface(window_) != EGL_NO_SURFACE) {
+        const char *extensions = eglQueryString(egl_display, EGL_EXTENSIONS);
+        // EGL_KHR_partial_updateだけの場合はeglSetDamageRegionKHRで描く範囲を
+        // 伝えないと全体が壊れた扱いになり、範囲外の内容が保たれないので使わない
+        buffer_age_ = hasExtension(extensions, "EGL_EXT_buffer_age");
+        if (hasExtension(extensions, "EGL_KHR_swap_buffers_with_damage")) {
+            swap_with_damage_ = reinterpret_cast<PFNEGLSWAPBUFFERSWITHDAMAGEKHRPROC>(eglGetProcAddress("eglSwapBuffersWithDamageKHR"));
+        }
+        else if (hasExtension(extensions, "EGL_EXT_swap_buffers_with_damage")) {
+            swap_with_damage_ = reinterpret_cast<PFNEGLSWAPBUFFERSWITHDAMAGEKHRPROC>(eglGetProcAddress("eglSwapBuffersWithDamageEXT"));
+        }
+        Logger::log("buffer age: ", buffer_age_, ", swap with damage: ", swap_with_damage_ != nullptr);
+    }
+    parent_presented_ = false;
+    if (util::useSubsurface()) {
+        sprite_ = std::make_unique<SpriteSurface>(parent_->getCompositor(), parent_->getSubcompositor(), glfwGetWaylandWindow(window_), egl_display, glfwGetEGLContext(window_));
+        if (!*sprite_) {
+            Logger::log("subsurface is not available");
+            sprite_.reset();
+        }
+        glfwMakeContextCurrent(window_);
+        assert(glfwGetError(nullptr) == GLFW_NO_ERROR);
+    }
+#endif // USE_WAYLAND
+
     glfwSetWindowUserPointer(window_, this);
     assert(glfwGetError(nullptr) == GLFW_NO_ERROR);
 
@@ -153,6 +205,9 @@ Window::~Window() {
         program_.reset();
         glfwMakeContextCurrent(nullptr);
         assert(glfwGetError(nullptr) == GLFW_NO_ERROR);
+#if defined(USE_WAYLAND)
+        sprite_.reset();
+#endif // USE_WAYLAND
         glfwDestroyWindow(window_);
         assert(glfwGetError(nullptr) == GLFW_NO_ERROR);
     }
@@ -166,6 +221,10 @@ void Window::resize(int width, int height) {
     assert(glGetError() == GL_NO_ERROR);
     std::unique_lock<std::mutex> lock(mutex_);
     size_ = {width, height};
+    invalidate();
+#if defined(USE_WAYLAND)
+    parent_presented_ = false;
+#endif // USE_WAYLAND
 }
 
 void Window::focus(int focused) {
@@ -298,7 +357,7 @@ void dump(const std::vector<RenderInfo> &infos) {
     for (auto &info : infos) {
         if (std::holds_alternative<Element>(info)) {
             auto elem = std::get<Element>(info);
-            Logger::log(elem.filename.string());
+            Logger::log(ImagePath::get(elem.image).string());
         }
     }
 }
@@ -310,21 +369,31 @@ bool Window::draw(std::unique_ptr<ImageCache> &image_cache, Offset offset, const
     bool regenerate = false;
     glfwMakeContextCurrent(window_);
     assert(glfwGetError(nullptr) == GLFW_NO_ERROR);
-    cache_->clearCache(false);
-    std::unique_ptr<Texture> &texture = cache_->get(image_cache, list, program_, use_self_alpha);
-    glClearColor(0.0, 0.0, 0.0, 0.0);
-    assert(glGetError() == GL_NO_ERROR);
-    glClear(GL_COLOR_BUFFER_BIT);
-    assert(glGetError() == GL_NO_ERROR);
+#if defined(USE_WAYLAND)
+    if (sprite_) {
+        sprite_->makeCurrent();
+    }
+#endif // USE_WAYLAND
+    // 読み込み中の画像があれば欠けたものを見せないように前回のものを描き続け
+    // 位置合わせや大きさの更新も全て読み込めてから行う
+    bool pending = !cache_->ready(image_cache, list);
+    const auto &target = (pending) ? (prev_list_) : (list);
+    std::unique_ptr<Texture> &texture = cache_->get(image_cache, target, program_, use_self_alpha);
+    // 前回から描き変わる範囲
+    std::optional<Rect> damaged;
+    Rect viewport = {0, 0, 0, 0};
     if (*texture) {
         auto [x, y, w, h] = texture->rect();
         auto r = getMonitorRect();
-        while (adjust_) {
+        while (adjust_ && !pending) {
             int side = parent_->side();
             int origin_x = r.x + r.width;
             if (side > 0) {
                 auto o = parent_->getCharacterOffset(side - 1);
                 if (!o) {
+                    // 何も描かずに交換されるので次は全体を描く
+                    invalidate();
+                    repair(std::nullopt);
                     return false;
                 }
                 if (o->x < origin_x) {
@@ -348,20 +417,59 @@ bool Window::draw(std::unique_ptr<ImageCache> &image_cache, Offset offset, const
         parent_->setSize(x + w, y + h);
         // OpenGLは左下が原点なのでyは上下逆にする
         if (util::isWayland()) {
-            glViewport(offset.x - r.x + x, r.height - (offset.y - r.y + y + h), w, h);
+            viewport = {offset.x - r.x + x, r.height - (offset.y - r.y + y + h), w, h};
         }
         else {
-            glViewport(x, size_.y - (y + h), w, h);
+            viewport = {x, size_.y - (y + h), w, h};
         }
-        assert(glGetError() == GL_NO_ERROR);
-        program_->use(view);
-        program_->set(texture->id());
-        glBlendFuncSeparate(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA, GL_SRC_ALPHA, GL_ONE);
-        glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
-        assert(glGetError() == GL_NO_ERROR);
+#if defined(USE_WAYLAND)
+        if (sprite_) {
+            // 位置はsubsurfaceを動かすだけで描き直さない
+            sprite_->move(offset.x - r.x + x, offset.y - r.y + y);
+            sprite_->resize(w, h);
+            viewport = {0, 0, w, h};
+        }
+#endif // USE_WAYLAND
+        damaged = damage(viewport, texture->rect(), target);
+        prev_viewport_ = viewport;
+        prev_rect_ = texture->rect();
     }
     else {
-        parent_->setSize(0, 0);
+        if (!pending) {
+            parent_->setSize(0, 0);
+        }
+        prev_viewport_.reset();
+    }
+    if (!pending) {
+        prev_list_ = list;
+    }
+    prev_upconverted_ = texture->isUpconverted();
+    // バッファに残っている内容が古い分も含めて描き直す
+    auto redraw = repair(damaged);
+    if (!redraw || !redraw->empty()) {
+        if (redraw) {
+            glEnable(GL_SCISSOR_TEST);
+            assert(glGetError() == GL_NO_ERROR);
+            glScissor(redraw->x, redraw->y, redraw->width, redraw->height);
+            assert(glGetError() == GL_NO_ERROR);
+        }
+        glClearColor(0.0, 0.0, 0.0, 0.0);
+        assert(glGetError() == GL_NO_ERROR);
+        glClear(GL_COLOR_BUFFER_BIT);
+        assert(glGetError() == GL_NO_ERROR);
+        if (*texture) {
+            glViewport(viewport.x, viewport.y, viewport.width, viewport.height);
+            assert(glGetError() == GL_NO_ERROR);
+            program_->use(view);
+            program_->set(texture->id(), texture->uv());
+            glBlendFuncSeparate(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA, GL_SRC_ALPHA, GL_ONE);
+            glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+            assert(glGetError() == GL_NO_ERROR);
+        }
+        if (redraw) {
+            glDisable(GL_SCISSOR_TEST);
+            assert(glGetError() == GL_NO_ERROR);
+        }
     }
 #if defined(_WIN32) || defined(WIN32)
     if (*texture) {
@@ -456,14 +564,104 @@ bool Window::draw(std::unique_ptr<ImageCache> &image_cache, Offset offset, const
 #endif // USE_X11
     glfwMakeContextCurrent(nullptr);
     assert(glfwGetError(nullptr) == GLFW_NO_ERROR);
-    return texture->isUpconverted();
+    // 読み込みが終わったら描き直してもらう
+    return !pending && texture->isUpconverted();
+}
+
+// 前回と同じ位置、大きさで描く場合に変わった範囲を求める
+// 分からない場合はstd::nullopt
+std::optional<Rect> Window::damage(const Rect &viewport, const Rect &rect, const std::vector<RenderInfo> &list) {
+    // 高画質化の前後では同じ内容でも画素が変わる
+    if (!prev_viewport_ || !(prev_viewport_.value() == viewport) || !(prev_rect_ == rect) || !prev_upconverted_) {
+        return std::nullopt;
+    }
+    Rect d;
+    if (!cache_->damage(prev_list_, list, d)) {
+        return std::nullopt;
+    }
+    if (d.empty()) {
+        return Rect{0, 0, 0, 0};
+    }
+    // テクスチャ上の座標は左上が原点
+    return Rect{viewport.x + d.x, viewport.y + viewport.height - (d.y + d.height), d.width, d.height};
+}
+
+// damageを記録して、今回描き直す必要のある範囲を返す
+// バッファの内容が何フレーム前のものか分からなければ全体
+std::optional<Rect> Window::repair(const std::optional<Rect> &damage) {
+    damage_.push_front(damage);
+    if (damage_.size() > max_damage_history) {
+        damage_.pop_back();
+    }
+    int age = bufferAge();
+    if (age <= 0 || age > static_cast<int>(damage_.size())) {
+        return std::nullopt;
+    }
+    Rect r = {0, 0, 0, 0};
+    for (int i = 0; i < age; i++) {
+        if (!damage_[i]) {
+            return std::nullopt;
+        }
+        r = r.unite(damage_[i].value());
+    }
+    return r;
+}
+
+int Window::bufferAge() {
+#if defined(USE_WAYLAND)
+    if (!buffer_age_) {
+        return 0;
+    }
+    EGLint age = 0;
+    EGLSurface surface = sprite_ ? sprite_->surface() : glfwGetEGLSurface(window_);
+    if (!eglQuerySurface(glfwGetEGLDisplay(), surface, EGL_BUFFER_AGE_EXT, &age)) {
+        return 0;
+    }
+    return age;
+#else
+    return 0;
+#endif // USE_WAYLAND
 }
 
 void Window::swapBuffers() {
     glfwMakeContextCurrent(window_);
     assert(glfwGetError(nullptr) == GLFW_NO_ERROR);
+#if defined(USE_WAYLAND)
+    bool visible = (glfwGetWindowAttrib(window_, GLFW_VISIBLE) == GLFW_TRUE);
+    EGLSurface surface = glfwGetEGLSurface(window_);
+    if (sprite_) {
+        // ウィンドウ本体には透明な内容を1度だけ描く
+        if (!parent_presented_ && visible) {
+            glClearColor(0.0, 0.0, 0.0, 0.0);
+            assert(glGetError() == GL_NO_ERROR);
+            glClear(GL_COLOR_BUFFER_BIT);
+            assert(glGetError() == GL_NO_ERROR);
+            glfwSwapBuffers(window_);
+            assert(glfwGetError(nullptr) == GLFW_NO_ERROR);
+            parent_presented_ = true;
+        }
+        sprite_->makeCurrent();
+        surface = sprite_->surface();
+    }
+    // 変わった範囲を合成側に伝える
+    // 非表示のウィンドウで交換すると表示されてしまうのでglfwに任せる
+    if (swap_with_damage_ && !damage_.empty() && damage_.front() && !damage_.front()->empty() &&
+            (sprite_ || visible)) {
+        auto &d = damage_.front().value();
+        EGLint rect[4] = {d.x, d.y, d.width, d.height};
+        swap_with_damage_(glfwGetEGLDisplay(), surface, rect, 1);
+    }
+    else if (sprite_) {
+        eglSwapBuffers(glfwGetEGLDisplay(), surface);
+    }
+    else {
+        glfwSwapBuffers(window_);
+        assert(glfwGetError(nullptr) == GLFW_NO_ERROR);
+    }
+#else
     glfwSwapBuffers(window_);
     assert(glfwGetError(nullptr) == GLFW_NO_ERROR);
+#endif // USE_WAYLAND
     glfwMakeContextCurrent(nullptr);
     assert(glfwGetError(nullptr) == GLFW_NO_ERROR);
 }
@@ -508,10 +706,29 @@ void Window::setCursor(GLFWcursor *cursor) {
     assert(glfwGetError(nullptr) == GLFW_NO_ERROR);
 }
 
+// 期限までに作れた分だけ作る
+// 全て作り終えたらtrue
+bool Window::prefetch(std::unique_ptr<ImageCache> &image_cache, const std::vector<Element> &list, const bool use_self_alpha, std::chrono::steady_clock::time_point deadline) {
+    glfwMakeContextCurrent(window_);
+    assert(glfwGetError(nullptr) == GLFW_NO_ERROR);
+    bool done = true;
+    for (auto &e : list) {
+        if (std::chrono::steady_clock::now() >= deadline) {
+            done = false;
+            break;
+        }
+        done = cache_->prefetch(image_cache, e, program_, use_self_alpha) && done;
+    }
+    glfwMakeContextCurrent(nullptr);
+    assert(glfwGetError(nullptr) == GLFW_NO_ERROR);
+    return done;
+}
+
 void Window::clearCache() {
     glfwMakeContextCurrent(window_);
     assert(glfwGetError(nullptr) == GLFW_NO_ERROR);
     cache_->clearCache();
+    invalidate();
     glfwMakeContextCurrent(nullptr);
     assert(glfwGetError(nullptr) == GLFW_NO_ERROR);
 }
@@ -2,6 +2,7 @@
 #define WINDOW_H_
 
 #include <chrono>
+#include <deque>
 #include "glad/glad.h"
 #include <GLFW/glfw3.h>
 #include <glm/glm.hpp>
@@ -11,6 +12,12 @@
 #include <optional>
 #include <unordered_map>
 
+#if defined(USE_WAYLAND)
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include "sprite_surface.h"
+#endif // USE_WAYLAND
+
 #include "ayu_.h"
 #include "image_cache.h"
 #include "logger.h"
@@ -45,6 +52,27 @@ class Window {
         int counter_;
         Offset offset_;
         std::optional<std::vector<Rect>> region_;
+        // 前回描いた内容
+        // 変わった所だけを描き直すのに使う
+        std::vector<RenderInfo> prev_list_;
+        std::optional<Rect> prev_viewport_;
+        Rect prev_rect_;
+        bool prev_upconverted_;
+        // 各フレームで描き変えた範囲(新しい順)
+        // std::nulloptは全体
+        std::deque<std::optional<Rect>> damage_;
+#if defined(USE_WAYLAND)
+        bool buffer_age_;
+        PFNEGLSWAPBUFFERSWITHDAMAGEKHRPROC swap_with_damage_;
+        // AYU_WAYLAND_SUBSURFACEが設定されている場合のみ
+        std::unique_ptr<SpriteSurface> sprite_;
+        // ウィンドウ本体に透明な内容を描いたかどうか
+        bool parent_presented_;
+#endif // USE_WAYLAND
+
+        std::optional<Rect> damage(const Rect &viewport, const Rect &rect, const std::vector<RenderInfo> &list);
+        std::optional<Rect> repair(const std::optional<Rect> &damage);
+        int bufferAge();
 
         static void resizeCallback(GLFWwindow *window, int width, int height) {
             auto instance = static_cast<Window *>(glfwGetWindowUserPointer(window));
@@ -115,6 +143,7 @@ class Window {
 
         bool draw(std::unique_ptr<ImageCache> &image_cache, Offset offset, const std::vector<RenderInfo> &list, const bool use_self_alpha);
         void swapBuffers();
+        bool prefetch(std::unique_ptr<ImageCache> &image_cache, const std::vector<Element> &list, const bool use_self_alpha, std::chrono::steady_clock::time_point deadline);
 
         void setPosition(int x, int y) {
             monitor_rect_.x = x;
@@ -135,6 +164,9 @@ class Window {
         void hide() {
             glfwHideWindow(window_);
             assert(glfwGetError(nullptr) == GLFW_NO_ERROR);
+#if defined(USE_WAYLAND)
+            parent_presented_ = false;
+#endif // USE_WAYLAND
         }
 
         Position<int> getPosition() {
@@ -168,6 +200,11 @@ class Window {
 
         void clearCache();
 
+        // 次の描画では全体を描き直す
+        void invalidate() {
+            prev_viewport_.reset();
+        }
+
 #if defined(USE_WAYLAND)
         void increment() {
             counter_++;